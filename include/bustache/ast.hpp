@@ -7,11 +7,70 @@
 #ifndef BUSTACHE_AST_HPP_INCLUDED
 #define BUSTACHE_AST_HPP_INCLUDED
 
-#include <unordered_map>
+#include <memory_resource>
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
-#include <string>
+#include <span>
 #include <string_view>
 
+namespace bustache
+{
+    // A key, or a segment of one, with its hash computed when the format is
+    // built.
+    struct key_descriptor
+    {
+        std::string_view str;
+        std::size_t hash = 0;
+
+        constexpr key_descriptor() = default;
+
+        constexpr explicit key_descriptor(std::string_view str) noexcept : str(str), hash(hash_of(str)) {}
+
+        // FNV-1a, which is constant-evaluated for the static formats.
+        static constexpr std::size_t hash_of(std::string_view str) noexcept
+        {
+            std::uint64_t h = 14695981039346656037u;
+            for (auto const c : str)
+            {
+                h ^= static_cast<unsigned char>(c);
+                h *= 1099511628211u;
+            }
+            return std::size_t(h);
+        }
+
+        friend constexpr bool operator==(key_descriptor const& a, std::string_view b) noexcept
+        {
+            return a.str == b;
+        }
+
+        friend constexpr auto operator<=>(key_descriptor const& a, std::string_view b) noexcept
+        {
+            return a.str <=> b;
+        }
+    };
+
+    // A transparent hash for the maps with string keys, which takes the hash
+    // of a `key_descriptor` instead of hashing the key again. Used with
+    // `std::equal_to<>`, it makes such map look up a `key_descriptor`.
+    struct key_hash
+    {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view str) const noexcept
+        {
+            return key_descriptor::hash_of(str);
+        }
+
+        std::size_t operator()(key_descriptor const& key) const noexcept
+        {
+            return key.hash;
+        }
+    };
+}
+
 namespace bustache::ast
 {
     enum class type
@@ -33,40 +92,67 @@ namespace bustache::ast
         type kind = type::null;
         unsigned index;
 
-        bool is_null() const { return kind == type::null; }
+        constexpr bool is_null() const { return kind == type::null; }
     };
 
     using text = std::string_view;
 
-    using content_list = std::vector<content>;
+    using content_list = std::pmr::vector<content>;
 
-    using override_map = std::unordered_map<std::string, content_list>;
+    struct override_map : std::pmr::vector<std::pair<std::string_view, content_list>>
+    {
+        using vector::vector;
 
+        const_iterator find(std::string_view key) const noexcept
+        {
+            return std::find_if(begin(), end(), [key](value_type const& pair)
+            {
+                return pair.first == key;
+            });
+        }
+    };
+
+    // A key split on '.', as a range of `context::segments`. An empty first
+    // segment refers to the current data, as in `.` and `.a`.
+    struct path
+    {
+        unsigned index = 0;
+        unsigned size = 0;
+    };
+
+    // Keys & indents are views, a `format` keeps its own copy of them and
+    // fills in the paths.
     struct variable
     {
-        std::string key;
+        std::string_view key;
         unsigned split;
+        ast::path path{};
     };
 
     struct block
     {
-        std::string key;
+        std::string_view key;
         content_list contents;
+        ast::path path{};
+        // The contents are a single text, which is output as is instead of
+        // visiting them, see `optimize`.
+        bool text_only = false;
     };
 
     struct partial
     {
-        std::string key;
-        std::string indent;
+        std::string_view key;
+        std::string_view indent;
         override_map overriders;
     };
 
     struct context
     {
-        std::vector<text> texts;
-        std::vector<variable> variables;
-        std::vector<block> blocks;
-        std::vector<partial> partials;
+        std::pmr::vector<text> texts;
+        std::pmr::vector<variable> variables;
+        std::pmr::vector<block> blocks;
+        std::pmr::vector<partial> partials;
+        std::pmr::vector<key_descriptor> segments;
 
         content add(text node)
         {
@@ -116,6 +202,11 @@ namespace bustache::ast
             return c.kind == K ? tag<K>::data(*this) + c.index : nullptr;
         }
 
+        std::span<key_descriptor const> get_path(path p) const noexcept
+        {
+            return {segments.data() + p.index, p.size};
+        }
+
         template<class F>
         auto visit(F&& f, content c) const -> decltype(auto)
         {
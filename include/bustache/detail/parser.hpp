@@ -0,0 +1,567 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_DETAIL_PARSER_HPP_INCLUDED
+#define BUSTACHE_DETAIL_PARSER_HPP_INCLUDED
+
+#include <bustache/format.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+// The parser is constexpr and generic over the `Builder` that receives the
+// nodes, so that it can run at compile time as well as in the library.
+// A `Builder` provides:
+//  - the node types `content_list`, `block` & `partial`, which are
+//    `ast::block` & `ast::partial` alike;
+//  - `add` & `get_if` as in `ast::context`;
+//  - `next(i, e, c)`, the first position in [i, e) that is '\n' or `c`;
+//  - `find(i, e, c)`, the first position in [i, e) that is `c`;
+//  - optionally `checkpoint(list, section, i0, i, pure, d)`, called with the
+//    state before each step of a nested content list.
+namespace bustache::detail::parser
+{
+    using I = char const*;
+
+    struct delim
+    {
+        std::string_view open;
+        std::string_view close;
+    };
+
+    constexpr bool is_space(char c)
+    {
+        switch (c)
+        {
+        case ' ':
+        case '\f':
+        case '\n':
+        case '\r':
+        case '\t':
+        case '\v':
+            return true;
+        }
+        return false;
+    }
+
+    // Return true if it ends.
+    constexpr bool skip(I& i, I e) noexcept
+    {
+        while (i != e)
+        {
+            if (!is_space(*i))
+                return false;
+            ++i;
+        }
+        return true;
+    }
+
+    constexpr bool parse_sentinel(I& i, I e, char c) noexcept
+    {
+        if (i != e && *i == c)
+        {
+            skip(++i, e);
+            return true;
+        }
+        return false;
+    }
+
+    constexpr bool parse_lit(I& i, I e, std::string_view str) noexcept
+    {
+        if (e - i < std::ptrdiff_t(str.size()))
+            return false;
+        I p = i;
+        for (char c : str)
+        {
+            if (*p != c)
+                return false;
+            ++p;
+        }
+        i = p;
+        return true;
+    }
+
+    constexpr unsigned expect_key(I b, I& i, I e, delim& d, std::string_view& attr, char sentinel)
+    {
+        unsigned split = 0;
+        skip(i, e);
+        for (I const i0 = i; i != e; ++i)
+        {
+            I const i1 = i;
+            skip(i, e);
+            if (!sentinel || parse_sentinel(i, e, sentinel))
+            {
+                if (parse_lit(i, e, d.close))
+                {
+                    if (split ? split + 1 == i1 - i0 : i0 == i1) [[unlikely]]
+                        break;
+                    attr = std::string_view(i0, i1 - i0);
+                    return split;
+                }
+            }
+            if (i == e) [[unlikely]]
+                break;
+            if (!split && *i == ':')
+            {
+                split = unsigned(i - i0);
+                if (!split) [[unlikely]]
+                    break;
+            }
+        }
+        throw format_error(error_badkey, i - b);
+    }
+
+    constexpr bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    constexpr bool is_align(char c)
+    {
+        return c == '<' || c == '>' || c == '^';
+    }
+
+    constexpr bool is_alpha(char c)
+    {
+        c |= 0x20;
+        return c >= 'a' && c <= 'z';
+    }
+
+    // A custom spec, e.g. `{{x:hex}}`, is a word, i.e. a letter followed by
+    // letters, digits, '_' or '-'. It's left to the formatter of the value
+    // printed, which checks it when first printed.
+    constexpr bool is_custom_spec(std::string_view spec) noexcept
+    {
+        if (spec.empty() || !is_alpha(spec.front()))
+            return false;
+        for (auto const c : spec)
+        {
+            if (!is_alpha(c) && !is_digit(c) && c != '_' && c != '-')
+                return false;
+        }
+        return true;
+    }
+
+    // Check the spec against the standard format spec:
+    // [[fill]align][sign]['#']['0'][width]['.'precision]['L'][type]
+    // A chrono spec, i.e. what follows the precision starts with '%', is
+    // also accepted, so is a custom spec.
+    constexpr bool is_valid_spec(std::string_view spec) noexcept
+    {
+        if (spec.find_first_of("{}") != spec.npos)
+            return false;
+        if (spec.empty() || is_custom_spec(spec))
+            return true;
+        auto i = spec.data();
+        auto const e = i + spec.size();
+        // The fill may be a UTF-8 encoded code point.
+        auto const fill = std::max(std::countl_one(static_cast<unsigned char>(*i)), 1);
+        if (e - i > fill && is_align(i[fill]))
+            i += fill + 1;
+        else if (is_align(*i))
+            ++i;
+        if (i != e && (*i == '+' || *i == '-' || *i == ' '))
+            ++i;
+        if (i != e && *i == '#')
+            ++i;
+        while (i != e && is_digit(*i))
+            ++i;
+        if (i != e && *i == '.')
+        {
+            if (++i == e || !is_digit(*i))
+                return false;
+            while (i != e && is_digit(*i))
+                ++i;
+        }
+        if (i != e && *i == 'L')
+            ++i;
+        if (i == e || *i == '%')
+            return true;
+        return e - i == 1 && (is_alpha(*i) || *i == '?');
+    }
+
+    constexpr void expect_spec(I b, std::string_view key, unsigned split)
+    {
+        if (split)
+        {
+            auto const spec = key.substr(split + 1);
+            if (!is_valid_spec(spec))
+                throw format_error(error_badspec, spec.data() - b);
+        }
+    }
+
+    // Call `f` on each segment of the key split on '.', where `.` alone is a
+    // single empty segment.
+    template<class F>
+    constexpr void for_each_segment(std::string_view key, F f)
+    {
+        if (key == ".")
+            return f(std::string_view());
+        for (std::size_t pos; (pos = key.find('.')) != key.npos; key.remove_prefix(pos + 1))
+            f(key.substr(0, pos));
+        f(key);
+    }
+
+    struct pure_result
+    {
+        I start;
+        bool standalone;
+    };
+
+    constexpr pure_result process_pure(I& i, I e, bool pure) noexcept
+    {
+        pure_result ret{i, pure};
+        if (pure)
+        {
+            while (i != e)
+            {
+                if (*i == '\n')
+                {
+                    ret.start = ++i;
+                    break;
+                }
+                else if (is_space(*i))
+                    ++i;
+                else
+                {
+                    ret.standalone = false;
+                    break;
+                }
+            }
+        }
+        return ret;
+    }
+
+    constexpr ast::type block_kind(char c)
+    {
+        switch (c)
+        {
+        case '#': return ast::type::section;
+        case '^': return ast::type::inversion;
+        case '?': return ast::type::filter;
+        case '*': return ast::type::loop;
+        default: return ast::type::inheritance;
+        }
+    }
+
+    struct tag_result
+    {
+        bool is_end_section;
+        bool check_standalone;
+        bool is_standalone;
+    };
+
+    template<class Builder>
+    struct parser
+    {
+        using content_list = typename Builder::content_list;
+        using block = typename Builder::block;
+        using partial = typename Builder::partial;
+
+        Builder& ctx;
+
+        constexpr void parse_start(I& i, I e, content_list& attr)
+        {
+            delim d{"{{", "}}"};
+            bool pure = true;
+            parse_contents(i, i, i, e, d, pure, attr, {});
+        }
+
+        constexpr bool parse_content
+        (
+            I b, I& i0, I& i, I e, delim& d, bool& pure,
+            std::string_view& text, ast::content& attr,
+            std::string_view section
+        );
+
+        constexpr void parse_contents
+        (
+            I b, I i0, I& i, I e, delim& d, bool& pure,
+            content_list& attr, std::string_view section
+        );
+
+        constexpr bool expect_block(I b, I& i, I e, delim& d, bool& pure, block& attr)
+        {
+            std::string_view key;
+            auto const split = expect_key(b, i, e, d, key, '\0');
+            auto const [i0, standalone] = process_pure(i, e, pure);
+            std::string_view section = key;
+            if (split)
+            {
+                attr.key = key.substr(split + 1);
+                section = key.substr(0, split);
+            }
+            else
+                attr.key = key;
+            parse_contents(b, i0, i, e, d, pure, attr.contents, section);
+            return standalone;
+        }
+
+        constexpr bool expect_inheritance(I b, I& i, I e, delim& d, bool& pure, partial& attr);
+
+        constexpr void expect_comment(I b, I& i, I e, delim& d);
+
+        constexpr tag_result expect_tag
+        (
+            I b, I& i, I e, delim& d, bool& pure,
+            ast::content& attr, std::string_view section
+        );
+    };
+
+    template<class Builder>
+    constexpr bool parser<Builder>::expect_inheritance(I b, I& i, I e, delim& d, bool& pure, partial& attr)
+    {
+        expect_key(b, i, e, d, attr.key, '\0');
+        auto [i0, standalone] = process_pure(i, e, pure);
+        for (std::string_view text;;)
+        {
+            ast::content a{};
+            auto const end = parse_content(b, i0, i, e, d, pure, text, a, attr.key);
+            if (auto const p = ctx.template get_if<ast::type::inheritance>(a))
+            {
+                if (attr.overriders.find(p->key) == attr.overriders.end())
+                    attr.overriders.emplace_back(p->key, std::move(p->contents));
+            }
+            if (end)
+                break;
+        }
+        return standalone;
+    }
+
+    template<class Builder>
+    constexpr void parser<Builder>::expect_comment(I b, I& i, I e, delim& d)
+    {
+        auto const c = d.close.front();
+        while (!parse_lit(i, e, d.close))
+        {
+            if (i == e)
+                throw format_error(error_delim, i - b);
+            i = ctx.find(i + 1, e, c);
+        }
+    }
+
+    constexpr void expect_set_delim(I b, I& i, I e, delim& d)
+    {
+        skip(i, e);
+        I i0 = i;
+        for (;;)
+        {
+            if (i == e)
+                throw format_error(error_baddelim, i - b);
+            if (is_space(*i))
+                break;
+            ++i;
+        }
+        d.open = std::string_view(i0, i - i0);
+        skip(i, e);
+        i0 = i;
+        I i1 = i;
+        for (;; ++i)
+        {
+            if (i == e)
+                throw format_error(error_set_delim, i - b);
+            if (*i == '=')
+            {
+                i1 = i;
+                break;
+            }
+            if (is_space(*i))
+            {
+                i1 = i;
+                if (skip(++i, e) || *i != '=')
+                    throw format_error(error_set_delim, i - b);
+                break;
+            }
+        }
+        if (i0 == i1)
+            throw format_error(error_baddelim, i - b);
+        skip(++i, e);
+        if (!parse_lit(i, e, d.close))
+            throw format_error(error_delim, i - b);
+        d.close = std::string_view(i0, i1 - i0);
+    }
+
+    template<class Builder>
+    constexpr tag_result parser<Builder>::expect_tag
+    (
+        I b, I& i, I e, delim& d, bool& pure,
+        ast::content& attr, std::string_view section
+    )
+    {
+        if (skip(i, e))
+            throw format_error(error_badkey, i - b);
+        tag_result ret{};
+        switch (*i)
+        {
+        case '#':
+        case '^':
+        case '?':
+        case '*':
+        case '$':
+        {
+            auto const kind = block_kind(*i);
+            block a;
+            ret.is_standalone = expect_block(b, ++i, e, d, pure, a);
+            attr = ctx.add(kind, std::move(a));
+            break;
+        }
+        case '/':
+            skip(++i, e);
+            if (!parse_lit(i, e, section))
+                throw format_error(error_section, i - b);
+            skip(i, e);
+            if (!parse_lit(i, e, d.close))
+                throw format_error(error_delim, i - b);
+            ret.check_standalone = pure;
+            ret.is_end_section = true;
+            break;
+        case '!':
+        {
+            expect_comment(b, ++i, e, d);
+            ret.check_standalone = pure;
+            break;
+        }
+        case '=':
+        {
+            expect_set_delim(b, ++i, e, d);
+            ret.check_standalone = pure;
+            break;
+        }
+        case '>':
+        {
+            partial a;
+            expect_key(b, ++i, e, d, a.key, '\0');
+            attr = ctx.add(std::move(a));
+            ret.check_standalone = pure;
+            break;
+        }
+        case '&':
+        case '{':
+        {
+            ast::variable a{};
+            char const sentinel = *i == '{' ? '}' : '\0';
+            a.split = expect_key(b, ++i, e, d, a.key, sentinel);
+            expect_spec(b, a.key, a.split);
+            attr = ctx.add(ast::type::var_raw, std::move(a));
+            pure = false;
+            break;
+        }
+        // Extensions
+        case '<':
+        {
+            partial a;
+            ret.is_standalone = expect_inheritance(b, ++i, e, d, pure, a);
+            attr = ctx.add(std::move(a));
+            return ret;
+        }
+        default:
+            ast::variable a{};
+            a.split = expect_key(b, i, e, d, a.key, '\0');
+            expect_spec(b, a.key, a.split);
+            attr = ctx.add(ast::type::var_escaped, std::move(a));
+            pure = false;
+            break;
+        }
+        return ret;
+    }
+
+    // Return true if it ends.
+    template<class Builder>
+    constexpr bool parser<Builder>::parse_content
+    (
+        I b, I& i0, I& i, I e, delim& d, bool& pure,
+        std::string_view& text, ast::content& attr,
+        std::string_view section
+    )
+    {
+        for (I i1 = i; i != e;)
+        {
+            if (*i == '\n')
+            {
+                pure = true;
+                i1 = ++i;
+            }
+            else if (is_space(*i))
+                ++i;
+            else
+            {
+                I const i2 = i;
+                if (parse_lit(i, e, d.open))
+                {
+                    tag_result tag(expect_tag(b, i, e, d, pure, attr, section));
+                    text = std::string_view(i0, i1 - i0);
+                    if (tag.check_standalone)
+                    {
+                        I const i3 = i;
+                        while (i != e)
+                        {
+                            if (*i == '\n')
+                            {
+                                ++i;
+                                break;
+                            }
+                            else if (is_space(*i))
+                                ++i;
+                            else
+                            {
+                                pure = false;
+                                text = std::string_view(i0, i2 - i0);
+                                // For end-section, we move the current pos (i)
+                                // since i0 is local to the section and is not
+                                // propagated upwards.
+                                (tag.is_end_section ? i : i0) = i3;
+                                return tag.is_end_section;
+                            }
+                        }
+                        tag.is_standalone = true;
+                    }
+                    if (!tag.is_standalone)
+                        text = std::string_view(i0, i2 - i0);
+                    else if (auto const p = ctx.template get_if<ast::type::partial>(attr))
+                        p->indent = std::string_view(i1, i2 - i1);
+                    i0 = i;
+                    return i == e || tag.is_end_section;
+                }
+                else
+                {
+                    // Nothing but a newline or a tag can change the state
+                    // from here, so jump to the next candidate.
+                    pure = false;
+                    i = ctx.next(i + 1, e, d.open.front());
+                }
+            }
+        }
+        text = std::string_view(i0, i - i0);
+        return true;
+    }
+
+    template<class Builder>
+    constexpr void parser<Builder>::parse_contents
+    (
+        I b, I i0, I& i, I e, delim& d, bool& pure,
+        content_list& attr, std::string_view section
+    )
+    {
+        for (;;)
+        {
+            if constexpr (requires { ctx.checkpoint(attr, section, i0, i, pure, d); })
+                ctx.checkpoint(attr, section, i0, i, pure, d);
+            std::string_view text;
+            ast::content a{};
+            auto end = parse_content(b, i0, i, e, d, pure, text, a, section);
+            if (!text.empty())
+                attr.push_back(ctx.add(text));
+            if (!a.is_null())
+                attr.push_back(a);
+            if (end)
+                return;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_EDITABLE_FORMAT_HPP_INCLUDED
+#define BUSTACHE_EDITABLE_FORMAT_HPP_INCLUDED
+
+#include <bustache/format.hpp>
+
+namespace bustache
+{
+    namespace detail
+    {
+        struct edit_state;
+    }
+
+    // A `format` over a source that it holds and that is edited in place.
+    // An edit parses again only the content lists it touches, the nodes
+    // elsewhere are kept.
+    struct editable_format
+    {
+        BUSTACHE_API explicit editable_format(std::string_view source);
+
+        BUSTACHE_API editable_format(editable_format&& other) noexcept;
+
+        BUSTACHE_API editable_format& operator=(editable_format&& other) noexcept;
+
+        BUSTACHE_API ~editable_format();
+
+        // Replace `count` chars of the source from `pos` with `str`, as
+        // `std::string::replace` does. If the new source fails to parse,
+        // `format_error` is thrown and the edit is not applied.
+        BUSTACHE_API void edit(std::size_t pos, std::size_t count, std::string_view str);
+
+        BUSTACHE_API std::string_view source() const noexcept;
+
+        format const& fmt() const noexcept
+        {
+            return _fmt;
+        }
+
+        template<class T>
+        manipulator<detail::manip_core<T>> operator()(T const& data) const
+        {
+            return {_fmt, data};
+        }
+
+    private:
+        std::unique_ptr<detail::edit_state> _state;
+        format _fmt;
+    };
+}
+
+#endif
@@ -12,6 +12,9 @@
 #include <cstddef>
 #include <utility>
 #include <memory>
+#include <memory_resource>
+#include <vector>
+#include <atomic>
 
 #if defined(_WIN32)
 #   ifdef BUSTACHE_EXPORT
@@ -48,6 +51,11 @@ namespace bustache
         {
             T const& escape;
         };
+
+        struct manip_buffer
+        {
+            std::size_t size;
+        };
     }
 
     template<class... Opts>
@@ -64,6 +72,12 @@ namespace bustache
         {
             return {static_cast<Opts const&>(*this)..., escape_};
         }
+
+        // The size of the buffer to render in, see `render`.
+        manipulator<Opts..., detail::manip_buffer> buffer_size(std::size_t size) const noexcept
+        {
+            return {static_cast<Opts const&>(*this)..., detail::manip_buffer{size}};
+        }
     };
 
     enum error_type
@@ -72,7 +86,9 @@ namespace bustache
         error_baddelim,
         error_delim,
         error_section,
-        error_badkey
+        error_badkey,
+        error_badspec,
+        error_badimage
     };
 
     class format_error : public std::runtime_error
@@ -87,38 +103,226 @@ namespace bustache
         std::ptrdiff_t position() const noexcept { return _pos; }
     };
 
+    // Where an escaped variable is output in HTML, which decides how it's
+    // escaped by a format that escapes by context.
+    enum class escape_context : unsigned char
+    {
+        html,
+        attribute,
+        unquoted,
+        url,
+        url_start,
+        script,
+        script_value,
+        style
+    };
+
+    struct parallel_options
+    {
+        // The number of threads to render on, 0 (the default) for
+        // `std::thread::hardware_concurrency()`.
+        unsigned threads = 0;
+        // The lists of fewer items are rendered serially.
+        std::size_t threshold = 1024;
+        // The number of items per chunk, 0 for about 4 chunks per thread.
+        std::size_t chunk_size = 0;
+    };
+
+    // Tag for building a `format` whose document lives in a single arena.
+    struct arena_t
+    {
+        explicit arena_t() = default;
+    };
+
+    inline constexpr arena_t arena{};
+
+    namespace detail
+    {
+        // Tag for building a `format` over the storage of a document that is
+        // complete, i.e. its keys are held & its paths are filled in, and
+        // that outlives the `format`. See <bustache/static_format.hpp>.
+        struct static_t
+        {
+            explicit static_t() = default;
+        };
+
+        struct program;
+        struct binding;
+        struct content_visitor;
+        struct value_vtable;
+
+        using native_fn = void(*)(content_visitor&);
+
+        // An overrider given to a partial by generated code.
+        struct native_override
+        {
+            std::string_view key;
+            native_fn body;
+        };
+
+        // The state of a formatter after parsing a spec, for the type of the
+        // value first printed. See <bustache/model.hpp>.
+        struct parsed_spec
+        {
+            void const* type;
+            void(*destroy)(parsed_spec const* self) noexcept;
+        };
+
+        using spec_slot = std::atomic<parsed_spec const*>;
+
+        // The specs of the variables of a document, by their index, parsed
+        // when first printed and then reused by all the renders, which may
+        // run at once. Along are the keys of its partials, as the context
+        // handler takes them, so they're not copied per expansion.
+        struct spec_cache
+        {
+            spec_slot* slots = nullptr;
+            std::size_t size = 0;
+            std::unique_ptr<spec_slot[]> owned;
+            std::unique_ptr<std::string[]> partial_keys;
+            std::size_t partials = 0;
+
+            spec_cache() = default;
+
+            // Over the slots that outlive it, e.g. in static storage.
+            spec_cache(spec_slot* slots, std::size_t size) noexcept : slots(slots), size(size) {}
+
+            spec_cache(spec_cache const&) = delete;
+            spec_cache& operator=(spec_cache const&) = delete;
+
+            ~spec_cache() { clear(); }
+
+            void clear() noexcept
+            {
+                for (std::size_t k = 0; k != size; ++k)
+                {
+                    if (auto const p = slots[k].exchange(nullptr))
+                        p->destroy(p);
+                }
+            }
+
+            // Empty slots for the variables of `ctx`.
+            void reset(ast::context const& ctx)
+            {
+                clear();
+                auto const n = ctx.variables.size();
+                owned.reset(new spec_slot[n]());
+                slots = owned.get();
+                size = n;
+                partial_keys.reset(new std::string[ctx.partials.size()]);
+                partials = ctx.partials.size();
+                for (std::size_t k = 0; k != partials; ++k)
+                    partial_keys[k] = ctx.partials[k].key;
+            }
+        };
+
+        // The document & the storage it refers to, which are shared by the
+        // copies of a `format` as they're never changed once built, but for
+        // the one of an `editable_format`.
+        struct document_storage
+        {
+            document_storage() = default;
+
+            explicit document_storage(ast::document&& doc) noexcept : doc(std::move(doc)) {}
+
+            document_storage(ast::document&& doc, spec_slot* slots) noexcept
+              : doc(std::move(doc)), specs(slots, this->doc.ctx.variables.size())
+            {}
+
+            // What the texts refer to, if it's held along, e.g. a mapping.
+            std::shared_ptr<void const> holder;
+            std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+            ast::document doc;
+            std::unique_ptr<char[]> text;
+            bool copytext = false;
+            bool edited = false;
+            spec_cache specs;
+        };
+
+        struct variable_escaping
+        {
+            escape_context context;
+            // The attribute value it's in, `attribute` or `unquoted`, which
+            // the output is escaped for as well; `html` if none.
+            escape_context within;
+        };
+
+        // The contexts of the variables of a document, by their index.
+        struct escaping
+        {
+            ast::context const* ctx;
+            std::vector<variable_escaping> contexts;
+        };
+
+        struct thread_pool;
+
+        // The options of a format rendered in parallel, and the threads that
+        // its renders share.
+        struct parallel
+        {
+            parallel_options options;
+            std::shared_ptr<thread_pool> pool;
+        };
+    }
+
     struct format
     {
         format() = default;
 
-        explicit format(std::string_view source)
+        explicit format(std::string_view source) : format(source, false) {}
+
+        format(std::string_view source, bool copytext)
+          : _storage(std::make_shared<detail::document_storage>())
         {
             init(source.data(), source.data() + source.size());
+            store(copytext);
         }
 
-        format(std::string_view source, bool copytext)
+        // The text is not copied but kept alive by `holder`.
+        format(std::string_view source, std::shared_ptr<void const> holder)
+          : _storage(std::make_shared<detail::document_storage>())
+        {
+            _storage->holder = std::move(holder);
+            init(source.data(), source.data() + source.size());
+            store(false);
+        }
+
+        format(std::string_view source, arena_t)
+          : _storage(std::make_shared<detail::document_storage>())
         {
             init(source.data(), source.data() + source.size());
-            if (copytext)
-                copy_text(text_size());
+            store_in_arena();
         }
 
         format(ast::document doc, bool copytext)
-          : _doc(std::move(doc))
+          : _storage(std::make_shared<detail::document_storage>(std::move(doc)))
+        {
+            store(copytext);
+        }
+
+        format(ast::document doc, arena_t)
+          : _storage(std::make_shared<detail::document_storage>(std::move(doc)))
         {
-            if (copytext)
-                copy_text(text_size());
+            store_in_arena();
         }
 
-        format(format&& other) = default;
+        // The storage is not owned, so nothing is allocated.
+        format(detail::document_storage& storage, detail::static_t) noexcept
+          : _storage(std::shared_ptr<detail::document_storage>(), &storage)
+        {}
 
-        format(format const& other) : _doc(other._doc)
+        format(format&& other) noexcept = default;
+
+        // The document is shared, unless it's edited in place.
+        format(format const& other)
+          : _storage(other._storage), _program(other._program), _binding(other._binding)
+          , _escaping(other._escaping), _parallel(other._parallel)
         {
-            if (other._text)
-                copy_text(text_size());
+            if (_storage && _storage->edited)
+                copy_edited(other);
         }
 
-        format& operator=(format&& other) = default;
+        format& operator=(format&& other) noexcept = default;
 
         format& operator=(format const& other)
         {
@@ -133,16 +337,88 @@ namespace bustache
 
         ast::document const& doc() const noexcept
         {
-            return _doc;
+            static ast::document const empty;
+            return _storage ? _storage->doc : empty;
+        }
+
+        detail::spec_cache const* specs() const noexcept
+        {
+            return _storage ? &_storage->specs : nullptr;
+        }
+
+        // Compile the document into a flat instruction stream, which is then
+        // used to render it instead of walking the nodes. The copies made
+        // after are compiled as well, the ones made before are not.
+        BUSTACHE_API void compile();
+
+        // Render with the function generated by `bustachec` instead of the
+        // document, see <bustache/generated.hpp>.
+        BUSTACHE_API void compile(detail::native_fn root);
+
+        bool compiled() const noexcept
+        {
+            return !!_program;
+        }
+
+        detail::program const* program() const noexcept
+        {
+            return _program.get();
+        }
+
+        // A copy that looks up the keys in the objects of `T`, and of the
+        // types of their members & items, by the members that the models
+        // list, which are resolved once here. The keys looked up in other
+        // objects, or in the other formats, are looked up as usual.
+        // Defined in <bustache/model.hpp>.
+        template<class T>
+        format bind() const;
+
+        bool bound() const noexcept
+        {
+            return !!_binding;
+        }
+
+        detail::binding const* binding() const noexcept
+        {
+            return _binding.get();
+        }
+
+        // Work out the context of each variable from the HTML around it, and
+        // escape `{{Tag}}` for it instead of by the escape action given to
+        // the render. The copies made after escape by context as well.
+        BUSTACHE_API void escape_by_context();
+
+        detail::escaping const* escaping() const noexcept
+        {
+            return _escaping.get();
+        }
+
+        // Render the long lists of the document, which have random access,
+        // on a pool of threads: the items are split into chunks, each
+        // rendered into its own buffer, and the buffers are written in order.
+        // The threads are started here and kept for the renders of it and
+        // of the copies made after, which render in parallel as well.
+        BUSTACHE_API void render_in_parallel(parallel_options const& options = {});
+
+        detail::parallel const* parallel() const noexcept
+        {
+            return _parallel.get();
         }
         
     private:
+        friend struct editable_format;
+
         BUSTACHE_API void init(char const* begin, char const* end);
-        BUSTACHE_API std::size_t text_size() const noexcept;
-        BUSTACHE_API void copy_text(std::size_t n);
+        BUSTACHE_API void store(bool copytext);
+        BUSTACHE_API void store_in_arena();
+        BUSTACHE_API void copy_edited(format const& other);
+        BUSTACHE_API format bind(detail::value_vtable const* root) const;
 
-        ast::document _doc;
-        std::unique_ptr<char[]> _text;
+        std::shared_ptr<detail::document_storage> _storage;
+        std::shared_ptr<detail::program const> _program;
+        std::shared_ptr<detail::binding const> _binding;
+        std::shared_ptr<detail::escaping const> _escaping;
+        std::shared_ptr<detail::parallel const> _parallel;
     };
 
     inline namespace literals
@@ -0,0 +1,103 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_GENERATED_HPP_INCLUDED
+#define BUSTACHE_GENERATED_HPP_INCLUDED
+
+#include <bustache/format.hpp>
+#include <bustache/model.hpp>
+#include <span>
+#include <string>
+
+namespace bustache::detail
+{
+    struct generated_access
+    {
+        static model kind_of(value_ptr val) noexcept
+        {
+            return val.vptr->kind;
+        }
+
+        static bool test(value_ptr val)
+        {
+            return static_cast<value_vtable const*>(val.vptr)->test(val.data);
+        }
+    };
+}
+
+// The runtime of the code generated by `bustachec`. A generated function
+// renders a content list: the texts are literals, the keys are looked up
+// from their segments as literals, and a section is a branch on the model
+// of the value found, which is tested or expanded on by the function of the
+// body. The runtime is called for the lookups, the objects & lists expanded
+// on, the lambdas, the overriders and the partials. The document isn't kept,
+// but a lambda is given the view of its section, which is parsed from the
+// source embedded along when first needed.
+namespace bustache::generated
+{
+    using frame = detail::content_visitor;
+
+    using body_fn = detail::native_fn;
+
+    using overrider = detail::native_override;
+
+    // The segments of a key.
+    using path = std::span<key_descriptor const>;
+
+    using view_fn = ast::view(*)();
+
+    BUSTACHE_API void text(frame& f, char const* data, std::size_t n);
+
+    // Look up & print a `ast::type::var_escaped` or `ast::type::var_raw`,
+    // with its spec parsed once into `slot`, if any.
+    BUSTACHE_API void variable(frame& f, ast::type kind, path keys, char const* spec = nullptr, detail::spec_slot* slot = nullptr);
+
+    // Look up the key of a block, `visit` is called with null if not found.
+    BUSTACHE_API void lookup(frame& f, path keys, value_handler visit);
+
+    inline model kind_of(value_ptr val) noexcept
+    {
+        return detail::generated_access::kind_of(val);
+    }
+
+    inline bool is_lazy(value_ptr val) noexcept
+    {
+        return kind_of(val) >= model::lazy_value;
+    }
+
+    // Whether the value, which is not lazy, is true.
+    inline bool test(value_ptr val)
+    {
+        return detail::generated_access::test(val);
+    }
+
+    // Expand `body` within the object.
+    BUSTACHE_API void with_object(frame& f, value_ptr val, body_fn body);
+
+    // Expand `body` on each item of the list, in parallel if the format is
+    // rendered so, or on the value if it's not a list.
+    BUSTACHE_API void for_each(frame& f, value_ptr val, body_fn body);
+
+    // Call the lambda for a block of `kind`, and return whether `body` is to
+    // be expanded then.
+    BUSTACHE_API bool lambda(frame& f, ast::type kind, value_ptr val, body_fn body, view_fn view);
+
+    // Expand the overrider of the inheritance block if there's one, and
+    // return whether there was.
+    BUSTACHE_API bool inherit(frame& f, std::string_view key);
+
+    BUSTACHE_API void partial(frame& f, std::string const& key, std::string_view indent, std::span<overrider const> overriders = {});
+
+    // Make the format that renders with `root`, which has no document.
+    inline format make_format(body_fn root)
+    {
+        format fmt;
+        fmt.compile(root);
+        return fmt;
+    }
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_LINK_HPP_INCLUDED
+#define BUSTACHE_LINK_HPP_INCLUDED
+
+#include <bustache/render.hpp>
+
+namespace bustache
+{
+    struct link_options
+    {
+        // Keep the blocks, so that the result can be overridden as a partial.
+        // Otherwise, the blocks are replaced by the contents they resolve to
+        // ahead, by the outermost overrider as the renderer does, and the
+        // result renders without looking up any overrider but for the
+        // partials kept.
+        bool overridable = true;
+    };
+
+    // Inline the partials that `context` has into a new format, recursively,
+    // so that rendering it doesn't look them up. The overriders of a partial
+    // inlined replace the contents of its blocks, and the indent of a
+    // standalone partial is applied to its texts ahead.
+    // A partial is kept as is, i.e. looked up in the context given to render,
+    // if `context` doesn't have it, if it's recursive, or if its indent can't
+    // be applied ahead, e.g. when a section in it may start a line or not.
+    // The blocks inlined can still be overridden by the partials that use the
+    // result if `overridable`, but not those in an indented partial, which is
+    // then kept.
+    // A lambda in an indented partial inlined sees the texts indented, and
+    // a format it returns is not indented. Used as a partial, the result is
+    // assumed to start on a line of its own.
+    // The result holds its texts & keys.
+    BUSTACHE_API format link(format const& fmt, context_handler context, link_options const& options = {});
+}
+
+#endif
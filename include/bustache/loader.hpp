@@ -0,0 +1,75 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_LOADER_HPP_INCLUDED
+#define BUSTACHE_LOADER_HPP_INCLUDED
+
+#include <bustache/format.hpp>
+#include <filesystem>
+#include <string>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace bustache
+{
+    // Partials by name, which can be used as the context of `render`.
+    struct partial_context : std::unordered_map<std::string, format>
+    {
+        using unordered_map::unordered_map;
+
+        static constexpr bool thread_safe = true;
+
+        format const* operator()(std::string const& key) const
+        {
+            auto it = find(key);
+            return it == end() ? nullptr : &it->second;
+        }
+    };
+
+    // A file that failed to load. `position` is that of the `format_error`,
+    // or -1 if the file can't be read.
+    struct load_error
+    {
+        std::filesystem::path file;
+        std::ptrdiff_t position;
+        std::string message;
+    };
+
+    struct load_result
+    {
+        partial_context partials;
+        std::vector<load_error> errors;
+    };
+
+    struct load_options
+    {
+        // The number of threads to parse the files on, 0 for as many as the
+        // hardware runs concurrently.
+        unsigned threads = 0;
+        // The extension of the files to load from a directory.
+        std::string extension = ".mustache";
+        // Map the files into memory instead of reading them, see `map_file`.
+        bool map = false;
+    };
+
+    // Parse the file mapped into memory read-only, whose texts are not
+    // copied but refer to the mapping, which the format & its copies hold.
+    // The file must not be truncated while it's mapped.
+    // Throws `std::filesystem::filesystem_error` if the file can't be mapped.
+    BUSTACHE_API format map_file(std::filesystem::path const& file);
+
+    // Load the files under `dir` with the extension, recursively. A partial
+    // is named after its path relative to `dir`, in generic format without
+    // the extension, e.g. "mail/header" for "mail/header.mustache".
+    BUSTACHE_API load_result load_partials(std::filesystem::path const& dir, load_options const& options = {});
+
+    // Load the files, each partial is named after the path without the
+    // extension.
+    BUSTACHE_API load_result load_partials(std::span<std::filesystem::path const> files, load_options const& options = {});
+}
+
+#endif
@@ -11,6 +11,9 @@
 #include <version> 
 #include <vector>
 #include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <new>
 #include <ranges>
 #include <concepts>
 #include <functional>
@@ -36,6 +39,11 @@ namespace bustache::detail
     namespace fmt = ::std;
 #endif
     struct vtable_base;
+    struct value_vtable;
+
+    // The vtable of `T` if it's a model, null otherwise.
+    template<class T>
+    value_vtable const* model_vt();
 
     template<class T>
     inline T const& deref_data(void const* p)
@@ -80,6 +88,7 @@ namespace bustache::detail
 
     struct content_visitor;
     struct object_ptr;
+    struct generated_access;
 }
 
 namespace bustache
@@ -144,6 +153,20 @@ namespace bustache
         {f(view)} -> Value;
     };
 
+    // A lazy value, format or render handler that can be called from several
+    // threads at once, so that the lists using it can be rendered in parallel.
+    template<class F>
+    struct thread_safe_fn : F
+    {
+        static constexpr bool thread_safe = true;
+    };
+
+    template<class F>
+    thread_safe_fn<F> thread_safe(F f)
+    {
+        return {std::move(f)};
+    }
+
     template<class T>
     concept Arithmetic = std::is_arithmetic_v<T>;
 
@@ -210,6 +233,46 @@ namespace bustache
 
     using output_handler = fn_ref<void(char const*, std::size_t)>;
 
+    // A summary of the keys of an object, as a bloom filter of 64 bits. A key
+    // that it can't contain is not looked up in the object. An object model
+    // can provide one by `impl_object<T>::keys(T const&) -> key_filter`, which
+    // is called once per scope & should be cheap, e.g. precomputed.
+    struct key_filter
+    {
+        std::uint64_t bits = 0;
+
+        static constexpr key_filter any() noexcept
+        {
+            return {~std::uint64_t(0)};
+        }
+
+        // The bits of a key, 2 of the 64 by its hash, never 0.
+        static constexpr std::uint64_t mask(key_descriptor const& key) noexcept
+        {
+            return (std::uint64_t(1) << (key.hash & 63)) | (std::uint64_t(1) << ((key.hash >> 6) & 63));
+        }
+
+        static constexpr std::uint64_t mask(std::string_view key) noexcept
+        {
+            return mask(key_descriptor(key));
+        }
+
+        constexpr void add(std::string_view key) noexcept
+        {
+            bits |= mask(key);
+        }
+
+        constexpr bool may_contain(std::uint64_t key_mask) const noexcept
+        {
+            return (bits & key_mask) == key_mask;
+        }
+
+        constexpr bool may_contain(std::string_view key) const noexcept
+        {
+            return may_contain(mask(key));
+        }
+    };
+
     struct value_ptr
     {
         constexpr value_ptr() { reset(); }
@@ -249,6 +312,7 @@ namespace bustache
 
         friend struct detail::content_visitor;
         friend struct detail::object_ptr;
+        friend struct detail::generated_access;
 
         void const* data;
         detail::vtable_base const* vptr;
@@ -256,6 +320,21 @@ namespace bustache
 
     using value_handler = fn_ref<void(value_ptr)>;
 
+    // A member of an object model, which `format::bind` resolves the keys to
+    // ahead. A model lists them as `impl_object<T>::members`, which gives its
+    // `get` as well if it has none.
+    struct member
+    {
+        std::string_view key;
+        value_ptr(*get)(void const* self);
+        // The vtable of the model of the member, null if it's not known ahead.
+        detail::value_vtable const*(*model)();
+
+        // The member of `key` is the data member `P`.
+        template<auto P>
+        static constexpr member of(std::string_view key) noexcept;
+    };
+
     struct value_ref
     {
         template<Value T>
@@ -293,26 +372,80 @@ namespace bustache::detail
         output_handler os;
     };
 
+    template<class Fmt>
+    struct parsed_spec_of : parsed_spec
+    {
+        Fmt fmt;
+    };
+
     template<class T>
-    void print_fmt(T const& self, output_handler os, char const* spec)
+    inline constexpr char spec_tag = 0; // Only the address is used.
+
+    template<class T>
+    void write_fmt(fmt::formatter<T>& fmt, T const& self, output_handler os)
     {
         using OutIter = std::back_insert_iterator<output_buffer>;
         using FmtCtx = fmt::basic_format_context<OutIter, char>;
+        output_buffer buf(os);
+        FmtCtx ctx{OutIter(buf), fmt::make_format_args<FmtCtx>()};
+        fmt.format(self, ctx);
+        buf.flush();
+    }
+
+    template<class T>
+    void print_fmt(T const& self, output_handler os, char const* spec)
+    {
         fmt::formatter<T> fmt;
         if (spec)
         {
             fmt::format_parse_context ctx{spec};
             fmt.parse(ctx);
         }
-        output_buffer buf(os);
-        FmtCtx ctx{OutIter(buf), fmt::make_format_args<FmtCtx>()};
-        fmt.format(self, ctx);
-        buf.flush();
+        write_fmt(fmt, self, os);
+    }
+
+    // The spec is parsed for the type first printed by the variable, and
+    // parsed each time for the others.
+    template<class T>
+    void print_fmt(T const& self, output_handler os, char const* spec, spec_slot& cache)
+    {
+        using Fmt = fmt::formatter<T>;
+        if constexpr (!std::is_copy_constructible_v<Fmt>)
+            print_fmt(self, os, spec);
+        else
+        {
+            auto p = cache.load(std::memory_order_acquire);
+            if (!p)
+            {
+                std::unique_ptr<parsed_spec_of<Fmt>> parsed(new parsed_spec_of<Fmt>{{&spec_tag<T>, [](parsed_spec const* self) noexcept
+                {
+                    delete static_cast<parsed_spec_of<Fmt> const*>(self);
+                }}, {}});
+                fmt::format_parse_context ctx{spec};
+                parsed->fmt.parse(ctx);
+                if (cache.compare_exchange_strong(p, parsed.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+                    p = parsed.release();
+            }
+            if (p->type != &spec_tag<T>)
+                return print_fmt(self, os, spec);
+            // Formatted by a copy, the parsed one is shared by the renders.
+            auto fmt = static_cast<parsed_spec_of<Fmt> const*>(p)->fmt;
+            write_fmt(fmt, self, os);
+        }
     }
 
     template<class T>
     struct type {};
 
+    template<class F>
+    constexpr bool is_thread_safe()
+    {
+        if constexpr (requires{{F::thread_safe} -> std::convertible_to<bool>;})
+            return F::thread_safe;
+        else
+            return false;
+    }
+
     struct vtable_base
     {
         model kind;
@@ -321,9 +454,12 @@ namespace bustache::detail
     struct lazy_format_vtable : vtable_base
     {
         template<class F>
-        constexpr lazy_format_vtable(type<F>) : vtable_base{model::lazy_format}, call(call_impl<F>) {}
+        constexpr lazy_format_vtable(type<F>)
+            : vtable_base{model::lazy_format}, call(call_impl<F>), thread_safe(is_thread_safe<F>())
+        {}
 
         format(*call)(void const*, ast::view const*);
+        bool thread_safe;
 
         template<class F>
         static format call_impl(void const* self, ast::view const* view)
@@ -338,9 +474,12 @@ namespace bustache::detail
     struct lazy_value_vtable : vtable_base
     {
         template<class F>
-        constexpr lazy_value_vtable(type<F>) : vtable_base{model::lazy_value}, call(call_impl<F>) {}
+        constexpr lazy_value_vtable(type<F>)
+            : vtable_base{model::lazy_value}, call(call_impl<F>), thread_safe(is_thread_safe<F>())
+        {}
 
         void(*call)(void const*, ast::view const*, value_handler visit);
+        bool thread_safe;
 
         template<class F>
         static void call_impl(void const* self, ast::view const* view, value_handler visit)
@@ -379,51 +518,182 @@ namespace bustache::detail
 
     struct print_trait
     {
-        constexpr print_trait(...) : print(print_default) {}
+        constexpr print_trait(...) : print(print_default), print_parsed(print_parsed_default), raw() {}
 
         template<class T> requires requires{impl_print<T>{};}
-        constexpr print_trait(type<T>) : print(print_impl<T>) {}
+        constexpr print_trait(type<T>) : print(print_impl<T>), print_parsed(print_parsed_impl<T>), raw(raw_of<T>()) {}
 
         void(*print)(void const* self, output_handler os, char const* spec);
+        void(*print_parsed)(void const* self, output_handler os, char const* spec, spec_slot& cache);
+        // Whether it's printed unescaped by any tag, see `safe_string`.
+        bool raw;
+
+        template<class T>
+        static constexpr bool raw_of()
+        {
+            if constexpr (requires{{impl_print<T>::raw} -> std::convertible_to<bool>;})
+                return impl_print<T>::raw;
+            else
+                return false;
+        }
 
         static void print_default(void const*, output_handler, char const*) {}
 
+        static void print_parsed_default(void const*, output_handler, char const*, spec_slot&) {}
+
         template<class T>
         static void print_impl(void const* self, output_handler os, char const* spec)
         {
             return impl_print<T>::print(deref_data<T>(self), os, spec);
         }
+
+        // Reuse the parsed spec if the trait knows how to, otherwise it's
+        // the same as `print_impl`.
+        template<class T>
+        static void print_parsed_impl(void const* self, output_handler os, char const* spec, spec_slot& cache)
+        {
+            if constexpr (requires{impl_print<T>::print(deref_data<T>(self), os, spec, cache);})
+                return impl_print<T>::print(deref_data<T>(self), os, spec, cache);
+            else
+                return impl_print<T>::print(deref_data<T>(self), os, spec);
+        }
     };
 
     struct object_trait
     {
-        constexpr object_trait(...) : get(get_default) {}
+        constexpr object_trait(...) : get(get_default), get_key(), keys(), members() {}
 
         template<class T> requires requires{impl_object<T>{};}
-        constexpr object_trait(type<T>) : get(get_impl<T>) {}
+        constexpr object_trait(type<T>) : get(get_impl<T>), get_key(get_key_of<T>()), keys(keys_of<T>()), members(members_of<T>()) {}
 
         void(*get)(void const* self, std::string const& key, value_handler visit);
+        // Null if the model doesn't take a `key_descriptor`.
+        void(*get_key)(void const* self, key_descriptor key, value_handler visit);
+        // Null if the model doesn't summarize its keys.
+        key_filter(*keys)(void const* self);
+        // Empty if the model doesn't list its members.
+        std::span<member const> members;
 
         static void get_default(void const*, std::string const&, value_handler visit)
         {
             visit(nullptr);
         }
 
+        template<class T>
+        static constexpr bool takes_key = requires(T const& self, key_descriptor key, value_handler visit)
+        {
+            impl_object<T>::get(self, key, visit);
+        };
+
         template<class T>
         static void get_impl(void const* self, std::string const& key, value_handler visit)
+        {
+            if constexpr (requires(T const& self){impl_object<T>::get(self, key, visit);})
+                return impl_object<T>::get(deref_data<T>(self), key, visit);
+            else if constexpr (takes_key<T>)
+                return impl_object<T>::get(deref_data<T>(self), key_descriptor(key), visit);
+            else
+            {
+                for (auto const& m : impl_object<T>::members)
+                {
+                    if (m.key == key)
+                        return visit(m.get(self));
+                }
+                return visit(nullptr);
+            }
+        }
+
+        template<class T>
+        static constexpr std::span<member const> members_of()
+        {
+            if constexpr (requires{std::span<member const>(impl_object<T>::members);})
+                return impl_object<T>::members;
+            else
+                return {};
+        }
+
+        template<class T>
+        static void get_key_impl(void const* self, key_descriptor key, value_handler visit)
         {
             return impl_object<T>::get(deref_data<T>(self), key, visit);
         }
+
+        template<class T>
+        static constexpr void(*get_key_of())(void const*, key_descriptor, value_handler)
+        {
+            if constexpr (takes_key<T>)
+                return get_key_impl<T>;
+            else
+                return nullptr;
+        }
+
+        template<class T>
+        static key_filter keys_impl(void const* self)
+        {
+            return impl_object<T>::keys(deref_data<T>(self));
+        }
+
+        template<class T>
+        static constexpr key_filter(*keys_of())(void const*)
+        {
+            if constexpr (requires(T const& self){{impl_object<T>::keys(self)} -> std::convertible_to<key_filter>;})
+                return keys_impl<T>;
+            else
+                return nullptr;
+        }
     };
 
     struct list_trait
     {
-        constexpr list_trait(...) : iterate() {}
+        constexpr list_trait(...) : iterate(), item(), size(), at() {}
 
         template<class T> requires requires{impl_list<T>{};}
-        constexpr list_trait(type<T>) : iterate(iterate_impl<T>) {}
+        constexpr list_trait(type<T>)
+            : iterate(iterate_impl<T>), item(item_of<T>())
+            , size(random_access<T> ? size_impl<T> : nullptr), at(random_access<T> ? at_impl<T> : nullptr)
+        {}
 
         void(*iterate)(void const* self, value_handler visit);
+        // The vtable of the model of the items, null if it's not known ahead.
+        value_vtable const*(*item)();
+        // Random access to the items, null if the model doesn't provide it
+        // by `impl_list<T>::size` & `impl_list<T>::at`.
+        std::size_t(*size)(void const* self);
+        value_ptr(*at)(void const* self, std::size_t i);
+
+        template<class T>
+        static constexpr bool random_access = requires(T const& self)
+        {
+            {impl_list<T>::size(self)} -> std::convertible_to<std::size_t>;
+            {impl_list<T>::at(self, std::size_t())} -> std::convertible_to<value_ptr>;
+        };
+
+        template<class T>
+        static std::size_t size_impl(void const* self)
+        {
+            if constexpr (random_access<T>)
+                return impl_list<T>::size(deref_data<T>(self));
+            else
+                return 0;
+        }
+
+        template<class T>
+        static value_ptr at_impl(void const* self, std::size_t i)
+        {
+            if constexpr (random_access<T>)
+                return impl_list<T>::at(deref_data<T>(self), i);
+            else
+                return nullptr;
+        }
+
+        template<class T>
+        static constexpr value_vtable const*(*item_of())()
+        {
+            if constexpr (std::ranges::range<T>)
+                return model_vt<std::ranges::range_value_t<T>>;
+            else
+                return nullptr;
+        }
 
         template<class T>
         static void iterate_impl(void const* self, value_handler visit)
@@ -449,6 +719,25 @@ namespace bustache::detail
     template<class T>
     constexpr value_vtable value_vt{type<T>{}};
 
+    template<class T>
+    value_vtable const* model_vt()
+    {
+        if constexpr (Model<T>)
+            return &value_vt<T>;
+        else
+            return nullptr;
+    }
+
+    template<class P>
+    struct member_pointer;
+
+    template<class C, class M>
+    struct member_pointer<M C::*>
+    {
+        using object_type = C;
+        using member_type = M;
+    };
+
     template<model K, class T>
     struct check_model;
 
@@ -478,6 +767,22 @@ namespace bustache
         vptr = &detail::value_vt<T>;
     }
 
+    template<auto P>
+    constexpr member member::of(std::string_view key) noexcept
+    {
+        using traits = detail::member_pointer<decltype(P)>;
+        using C = typename traits::object_type;
+        using M = typename traits::member_type;
+        return {key, [](void const* self) { return value_ptr(&(detail::deref_data<C>(self).*P)); }, detail::model_vt<M>};
+    }
+
+    template<class T>
+    inline format format::bind() const
+    {
+        static_assert(Model<T>, "T must be a model");
+        return bind(&detail::value_vt<T>);
+    }
+
     template<class F>
     inline void value_ptr::init_lazy_format(F const* f) noexcept
     {
@@ -511,6 +816,7 @@ namespace bustache
     struct impl_print<bool>
     {
         static BUSTACHE_API void print(bool self, output_handler os, char const* spec);
+        static BUSTACHE_API void print(bool self, output_handler os, char const* spec, detail::spec_slot& cache);
     };
 
     template<Arithmetic T>
@@ -547,11 +853,54 @@ namespace bustache
     struct impl_print<std::string_view>
     {
         static BUSTACHE_API void print(std::string_view self, output_handler os, char const* spec);
+        static BUSTACHE_API void print(std::string_view self, output_handler os, char const* spec, detail::spec_slot& cache);
     };
 
     template<String T>
     struct impl_print<T> : impl_print<std::string_view> {};
 
+    // A string that is output as is, even by an escaped tag, e.g. HTML that
+    // has been sanitized or escaped ahead.
+    struct safe_string
+    {
+        std::string str;
+
+        // The text escaped as `escape_html` does, once for all the renders.
+        BUSTACHE_API static safe_string escaped(std::string_view text);
+    };
+
+    template<>
+    struct impl_model<safe_string>
+    {
+        static constexpr model kind = model::atom;
+    };
+
+    template<>
+    struct impl_test<safe_string>
+    {
+        static bool test(safe_string const& self)
+        {
+            return !self.str.empty();
+        }
+    };
+
+    template<>
+    struct impl_print<safe_string>
+    {
+        // Printed to the raw sink whatever the tag is.
+        static constexpr bool raw = true;
+
+        static void print(safe_string const& self, output_handler os, char const* spec)
+        {
+            impl_print<std::string_view>::print(self.str, os, spec);
+        }
+
+        static void print(safe_string const& self, output_handler os, char const* spec, detail::spec_slot& cache)
+        {
+            impl_print<std::string_view>::print(self.str, os, spec, cache);
+        }
+    };
+
     template<Formattable T> requires (!String<T>)
     struct impl_print<T>
     {
@@ -559,6 +908,11 @@ namespace bustache
         {
             detail::print_fmt(self, os, spec);
         }
+
+        static void print(T const& self, output_handler os, char const* spec, detail::spec_slot& cache)
+        {
+            detail::print_fmt(self, os, spec, cache);
+        }
     };
 
     template<StrValueMap T>
@@ -578,6 +932,15 @@ namespace bustache
             auto const found = self.find(key);
             visit(found == self.end() ? nullptr : &found->second);
         }
+
+        // A map with heterogeneous lookup, e.g. by `key_hash`, is looked up
+        // without a `std::string` or hashing the key again.
+        static void get(T const& self, key_descriptor key, value_handler visit)
+            requires requires{self.find(key);}
+        {
+            auto const found = self.find(key);
+            visit(found == self.end() ? nullptr : &found->second);
+        }
     };
 
     template<ValueRange T> requires (!String<T> && !StrValueMap<T>)
@@ -608,6 +971,20 @@ namespace bustache
             for (auto const& elem : self)
                 visit(&elem);
         }
+
+        static std::size_t size(T const& self)
+            requires std::ranges::random_access_range<T const> && std::ranges::sized_range<T const>
+                && std::is_lvalue_reference_v<std::ranges::range_reference_t<T const>>
+        {
+            return std::ranges::size(self);
+        }
+
+        static value_ptr at(T const& self, std::size_t i)
+            requires std::ranges::random_access_range<T const> && std::ranges::sized_range<T const>
+                && std::is_lvalue_reference_v<std::ranges::range_reference_t<T const>>
+        {
+            return &std::ranges::begin(self)[i];
+        }
     };
 
     template<String K, Value V>
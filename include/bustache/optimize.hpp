@@ -0,0 +1,36 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_OPTIMIZE_HPP_INCLUDED
+#define BUSTACHE_OPTIMIZE_HPP_INCLUDED
+
+#include <bustache/format.hpp>
+
+namespace bustache
+{
+    struct optimize_options
+    {
+        // Drop the empty sections, filters & loops too. A lambda given for
+        // one of them is still called, so this is off by default.
+        bool drop_empty_sections = false;
+    };
+
+    // Rewrite the document so that it renders the same with fewer nodes:
+    // adjacent texts are merged into one, also across the blocks dropped,
+    // and the empty inversions are dropped, which render nothing whatever
+    // the data is. A block whose body is then a single text is marked
+    // `text_only`, so the text is output without visiting the body. The
+    // blocks dropped don't look up their keys, so the unresolved handler is
+    // not called for them. The result holds its texts & keys.
+    BUSTACHE_API format optimize(ast::document const& doc, optimize_options const& options = {});
+
+    inline format optimize(format const& fmt, optimize_options const& options = {})
+    {
+        return optimize(fmt.doc(), options);
+    }
+}
+
+#endif
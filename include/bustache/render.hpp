@@ -8,15 +8,32 @@
 #define BUSTACHE_RENDER_HPP_INCLUDED
 
 #include <bustache/model.hpp>
+#include <algorithm>
+#include <memory>
 
 namespace bustache
 {
-    using unresolved_handler = fn_ptr<value_ptr(std::string const&)>;
+    // A handler of the render, which is called from the threads of a
+    // parallel render only if it's marked thread-safe as a lazy value is.
+    template<class Fn>
+    struct render_handler : Fn
+    {
+        bool thread_safe = false;
+
+        render_handler() = default;
+
+        template<class F> requires std::constructible_from<Fn, F const&>
+        render_handler(F const& f) noexcept : Fn(f), thread_safe(detail::is_thread_safe<F>()) {}
+    };
 
-    using context_handler = fn_ref<format const*(std::string const&)>;
+    using unresolved_handler = render_handler<fn_ptr<value_ptr(std::string const&)>>;
+
+    using context_handler = render_handler<fn_ref<format const*(std::string const&)>>;
 
     struct no_context_t
     {
+        static constexpr bool thread_safe = true;
+
         format const* operator()(std::string const&) const
         {
             return nullptr;
@@ -30,6 +47,8 @@ namespace bustache
     {
         Map const& map;
 
+        static constexpr bool thread_safe = true;
+
         map_context(Map const& map) noexcept : map(map) {}
 
         format const* operator()(std::string const& key) const
@@ -78,7 +97,7 @@ namespace bustache::detail
         }
     };
 
-    inline strlit get_escaped(char c) noexcept
+    constexpr strlit get_escaped(char c) noexcept
     {
         switch (c)
         {
@@ -91,28 +110,73 @@ namespace bustache::detail
         }
     }
 
+    // Write the text with the chars escaped as `get_escaped` does, in runs
+    // found a block at a time.
+    BUSTACHE_API void escape_html(char const* data, std::size_t bytes, output_handler sink);
+
+    // As in a JSON string: the quotes, the backslashes & the control chars.
+    BUSTACHE_API void escape_json(char const* data, std::size_t bytes, output_handler sink);
+
+    // As in a JavaScript string, with the quotes, '$' & the HTML specials as
+    // "\u00XX" so that the output is also safe in HTML & template literals.
+    BUSTACHE_API void escape_js(char const* data, std::size_t bytes, output_handler sink);
+
+    // Percent-encode all but the unreserved chars, as a URL component.
+    BUSTACHE_API void escape_url(char const* data, std::size_t bytes, output_handler sink);
+
     template<class Sink>
     struct escape_sink
     {
         Sink const& sink;
+        void(*escape)(char const* data, std::size_t bytes, output_handler sink) = escape_html;
 
         void operator()(const void* data, std::size_t bytes) const
         {
-            auto it = static_cast<char const*>(data);
-            auto last = it;
-            auto const end = it + bytes;
-            while (it != end)
+            escape(static_cast<char const*>(data), bytes, sink);
+        }
+    };
+
+    // Collect the output into a buffer, which is written to the sink in
+    // blocks when full, instead of a call per fragment.
+    struct render_buffer
+    {
+        output_handler sink;
+        char* data;
+        std::size_t capacity;
+        std::size_t size = 0;
+
+        void write(char const* p, std::size_t n)
+        {
+            if (n > capacity - size)
             {
-                if (auto const str = get_escaped(*it))
+                flush();
+                if (n >= capacity)
                 {
-                    sink(last, it - last);
-                    sink(str.data, str.size);
-                    last = ++it;
+                    sink(p, n);
+                    return;
                 }
-                else
-                    ++it;
             }
-            sink(last, it - last);
+            std::copy_n(p, n, data + size);
+            size += n;
+        }
+
+        void flush()
+        {
+            if (size)
+            {
+                sink(data, size);
+                size = 0;
+            }
+        }
+    };
+
+    struct buffer_sink
+    {
+        render_buffer& buffer;
+
+        void operator()(char const* data, std::size_t bytes) const
+        {
+            buffer.write(data, bytes);
         }
     };
 
@@ -140,6 +204,21 @@ namespace bustache
         return detail::escape_sink<Sink>{sink};
     };
 
+    constexpr auto escape_json = []<class Sink>(Sink const& sink)
+    {
+        return detail::escape_sink<Sink>{sink, detail::escape_json};
+    };
+
+    constexpr auto escape_js = []<class Sink>(Sink const& sink)
+    {
+        return detail::escape_sink<Sink>{sink, detail::escape_js};
+    };
+
+    constexpr auto escape_url = []<class Sink>(Sink const& sink)
+    {
+        return detail::escape_sink<Sink>{sink, detail::escape_url};
+    };
+
     namespace detail
     {
         inline no_escape_t get_escape(void const*)
@@ -160,15 +239,77 @@ namespace bustache
         return detail::get_escape(&manip);
     }
 
+    // The size of the buffer that `render` collects the output in, which
+    // is on the stack up to this size.
+    inline constexpr std::size_t default_buffer_size = 4096;
+
+    namespace detail
+    {
+        inline std::size_t get_buffer_size(void const*)
+        {
+            return default_buffer_size;
+        }
+
+        inline std::size_t get_buffer_size(manip_buffer const* p)
+        {
+            return p->size;
+        }
+
+        template<class Escape>
+        void render_buffered
+        (
+            char* buf, std::size_t size, output_handler os, format const& fmt, value_ptr data,
+            context_handler context, Escape const& escape, unresolved_handler f
+        )
+        {
+            render_buffer buffer{os, buf, size};
+            buffer_sink const sink{buffer};
+            try
+            {
+                render(sink, escape(sink), fmt, data, context, f);
+            }
+            catch (...)
+            {
+                buffer.flush();
+                throw;
+            }
+            buffer.flush();
+        }
+    }
+
+    template<class... Opts>
+    inline std::size_t get_buffer_size(manipulator<Opts...> const& manip)
+    {
+        return detail::get_buffer_size(&manip);
+    }
+
+    // The sink is called with the output in blocks of up to `buffer_size`
+    // bytes, or per fragment if it's 0. A fragment that doesn't fit in the
+    // buffer is written as is. The output buffered is written to
+    // the sink before an exception propagates.
     template<class Sink, class Escape = no_escape_t>
     inline void render
     (
         Sink const& os, format const& fmt, value_ref data,
         context_handler context = no_context_t{}, Escape escape = {},
-        unresolved_handler f = nullptr
+        unresolved_handler f = nullptr, std::size_t buffer_size = default_buffer_size
     )
     {
-        detail::render(os, escape(os), fmt, data.get_ptr(), context, f);
+        if (!buffer_size)
+        {
+            detail::render(os, escape(os), fmt, data.get_ptr(), context, f);
+            return;
+        }
+        if (buffer_size > default_buffer_size)
+        {
+            std::unique_ptr<char[]> const heap(new char[buffer_size]);
+            detail::render_buffered(heap.get(), buffer_size, os, fmt, data.get_ptr(), context, escape, f);
+        }
+        else
+        {
+            char local[default_buffer_size];
+            detail::render_buffered(local, buffer_size, os, fmt, data.get_ptr(), context, escape, f);
+        }
     }
 }
 
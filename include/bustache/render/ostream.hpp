@@ -31,17 +31,18 @@ namespace bustache
     (
         std::basic_ostream<CharT, Traits>& out, format const& fmt,
         T const& data, context_handler context = no_context_t{},
-        Escape escape = {}, unresolved_handler f = nullptr
+        Escape escape = {}, unresolved_handler f = nullptr,
+        std::size_t buffer_size = default_buffer_size
     )
     {
-        render(detail::ostream_sink<CharT, Traits>{out}, fmt, data, context, escape, f);
+        render(detail::ostream_sink<CharT, Traits>{out}, fmt, data, context, escape, f, buffer_size);
     }
     
     template<class CharT, class Traits, class... Opts>
     inline std::basic_ostream<CharT, Traits>&
     operator<<(std::basic_ostream<CharT, Traits>& out, manipulator<Opts...> const& manip)
     {
-        render_ostream(out, manip.fmt, manip.data, get_context(manip), get_escape(manip));
+        render_ostream(out, manip.fmt, manip.data, get_context(manip), get_escape(manip), nullptr, get_buffer_size(manip));
         return out;
     }
 }
@@ -31,17 +31,18 @@ namespace bustache
     (
         String& out, format const& fmt,
         T const& data, context_handler context = no_context_t{},
-        Escape escape = {}, unresolved_handler f = nullptr
+        Escape escape = {}, unresolved_handler f = nullptr,
+        std::size_t buffer_size = default_buffer_size
     )
     {
-        render(detail::string_sink<String>{out}, fmt, data, context, escape, f);
+        render(detail::string_sink<String>{out}, fmt, data, context, escape, f, buffer_size);
     }
     
     template<class... Opts>
     inline std::string to_string(manipulator<Opts...> const& manip)
     {
         std::string ret;
-        render_string(ret, manip.fmt, manip.data, get_context(manip), get_escape(manip));
+        render_string(ret, manip.fmt, manip.data, get_context(manip), get_escape(manip), nullptr, get_buffer_size(manip));
         return ret;
     }
 }
@@ -0,0 +1,32 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_SERIALIZE_HPP_INCLUDED
+#define BUSTACHE_SERIALIZE_HPP_INCLUDED
+
+#include <bustache/format.hpp>
+#include <string>
+
+namespace bustache
+{
+    // Version of the image layout, images of other versions are rejected.
+    inline constexpr unsigned image_version = 1;
+
+    // Serialize the document, with its texts and keys, into a binary image.
+    BUSTACHE_API std::string save_image(ast::document const& doc);
+
+    // Load the document from an image made by `save_image`, without parsing.
+    // The texts and keys refer to the image, give the document to a `format`
+    // to hold them.
+    BUSTACHE_API ast::document load_image(std::string_view image);
+
+    inline std::string save_image(format const& fmt)
+    {
+        return save_image(fmt.doc());
+    }
+}
+
+#endif
@@ -0,0 +1,370 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_STATIC_FORMAT_HPP_INCLUDED
+#define BUSTACHE_STATIC_FORMAT_HPP_INCLUDED
+
+#include <bustache/detail/parser.hpp>
+#include <array>
+#include <vector>
+
+namespace bustache::detail
+{
+    template<std::size_t N>
+    struct fixed_string
+    {
+        char data[N];
+
+        constexpr fixed_string(char const (&str)[N]) noexcept
+        {
+            std::copy_n(str, N, data);
+        }
+
+        constexpr std::string_view view() const noexcept
+        {
+            return {data, N - 1};
+        }
+    };
+
+    // Receives the nodes from the parser at compile time.
+    struct static_builder
+    {
+        using content_list = std::vector<ast::content>;
+
+        struct block
+        {
+            std::string_view key;
+            content_list contents;
+        };
+
+        struct override_map : std::vector<std::pair<std::string_view, content_list>>
+        {
+            constexpr const_iterator find(std::string_view key) const noexcept
+            {
+                return std::find_if(begin(), end(), [key](value_type const& pair)
+                {
+                    return pair.first == key;
+                });
+            }
+        };
+
+        struct partial
+        {
+            std::string_view key;
+            std::string_view indent;
+            override_map overriders;
+        };
+
+        std::vector<ast::text> texts;
+        std::vector<ast::variable> variables;
+        std::vector<block> blocks;
+        std::vector<partial> partials;
+
+        constexpr ast::content add(ast::text node)
+        {
+            texts.push_back(node);
+            return {ast::type::text, unsigned(texts.size() - 1)};
+        }
+
+        constexpr ast::content add(ast::type kind, ast::variable&& node)
+        {
+            variables.push_back(std::move(node));
+            return {kind, unsigned(variables.size() - 1)};
+        }
+
+        constexpr ast::content add(ast::type kind, block&& node)
+        {
+            blocks.push_back(std::move(node));
+            return {kind, unsigned(blocks.size() - 1)};
+        }
+
+        constexpr ast::content add(partial&& node)
+        {
+            partials.push_back(std::move(node));
+            return {ast::type::partial, unsigned(partials.size() - 1)};
+        }
+
+        template<ast::type K>
+        constexpr auto get_if(ast::content c)
+        {
+            if constexpr (K == ast::type::partial)
+                return c.kind == K ? partials.data() + c.index : nullptr;
+            else
+                return c.kind == K ? blocks.data() + c.index : nullptr;
+        }
+
+        static constexpr parser::I next(parser::I i, parser::I e, char c) noexcept
+        {
+            while (i != e && *i != '\n' && *i != c)
+                ++i;
+            return i;
+        }
+
+        static constexpr parser::I find(parser::I i, parser::I e, char c) noexcept
+        {
+            return std::find(i, e, c);
+        }
+    };
+
+    // A range in one of the arrays of `static_image`.
+    struct static_range
+    {
+        unsigned index = 0;
+        unsigned size = 0;
+    };
+
+    struct static_variable
+    {
+        static_range key;
+        unsigned split = 0;
+        ast::path path;
+    };
+
+    struct static_block
+    {
+        static_range key;
+        static_range contents;
+        ast::path path;
+    };
+
+    struct static_partial
+    {
+        static_range key;
+        static_range indent;
+        static_range overriders;
+    };
+
+    struct static_override
+    {
+        static_range key;
+        static_range contents;
+    };
+
+    struct static_size
+    {
+        std::size_t chars = 0;
+        std::size_t texts = 0;
+        std::size_t variables = 0;
+        std::size_t blocks = 0;
+        std::size_t partials = 0;
+        std::size_t overriders = 0;
+        std::size_t segments = 0;
+        std::size_t contents = 0;
+    };
+
+    // The parsed document laid out flat, with the strings (keys followed by
+    // '\0') in `chars` and the content lists in `contents`. This is what a
+    // `format` would hold after `store`.
+    struct static_document
+    {
+        std::vector<char> chars;
+        std::vector<static_range> texts;
+        std::vector<static_variable> variables;
+        std::vector<static_block> blocks;
+        std::vector<static_partial> partials;
+        std::vector<static_override> overriders;
+        std::vector<static_range> segments;
+        std::vector<ast::content> contents;
+        static_range root;
+
+        constexpr explicit static_document(std::string_view source)
+        {
+            static_builder ctx;
+            static_builder::content_list list;
+            auto i = source.data();
+            parser::parser<static_builder>{ctx}.parse_start(i, i + source.size(), list);
+            root = add(list);
+            for (auto const& text : ctx.texts)
+                texts.push_back(add(text, false));
+            for (auto const& variable : ctx.variables)
+            {
+                auto const key = add(variable.key, true);
+                auto const split = variable.split;
+                variables.push_back({key, split, add_path(key, split ? split : key.size)});
+            }
+            for (auto const& block : ctx.blocks)
+            {
+                auto const key = add(block.key, true);
+                blocks.push_back({key, add(block.contents), add_path(key, key.size)});
+            }
+            for (auto const& partial : ctx.partials)
+            {
+                static_range const overrides{unsigned(overriders.size()), unsigned(partial.overriders.size())};
+                for (auto const& pair : partial.overriders)
+                    overriders.push_back({add(pair.first, true), add(pair.second)});
+                partials.push_back({add(partial.key, true), add(partial.indent, false), overrides});
+            }
+        }
+
+        constexpr static_size size() const noexcept
+        {
+            return
+            {
+                chars.size(), texts.size(), variables.size(), blocks.size(),
+                partials.size(), overriders.size(), segments.size(), contents.size()
+            };
+        }
+
+    private:
+        constexpr static_range add(std::string_view str, bool cstr)
+        {
+            static_range const ret{unsigned(chars.size()), unsigned(str.size())};
+            chars.insert(chars.end(), str.begin(), str.end());
+            if (cstr)
+                chars.push_back('\0');
+            return ret;
+        }
+
+        constexpr static_range add(static_builder::content_list const& list)
+        {
+            static_range const ret{unsigned(contents.size()), unsigned(list.size())};
+            contents.insert(contents.end(), list.begin(), list.end());
+            return ret;
+        }
+
+        // Split the stored key in `chars` as `split_paths` does.
+        constexpr ast::path add_path(static_range key, unsigned n)
+        {
+            ast::path ret{unsigned(segments.size())};
+            std::string_view const str(chars.data() + key.index, n);
+            parser::for_each_segment(str, [&](std::string_view segment)
+            {
+                if (segment.empty())
+                    segments.push_back({});
+                else
+                    segments.push_back({unsigned(key.index + (segment.data() - str.data())), unsigned(segment.size())});
+            });
+            ret.size = unsigned(segments.size() - ret.index);
+            return ret;
+        }
+    };
+
+    // `static_document` in fixed arrays, so that it's a constant.
+    template<static_size N>
+    struct static_image
+    {
+        std::array<char, N.chars> chars{};
+        std::array<static_range, N.texts> texts{};
+        std::array<static_variable, N.variables> variables{};
+        std::array<static_block, N.blocks> blocks{};
+        std::array<static_partial, N.partials> partials{};
+        std::array<static_override, N.overriders> overriders{};
+        std::array<static_range, N.segments> segments{};
+        std::array<ast::content, N.contents> contents{};
+        static_range root;
+
+        constexpr explicit static_image(static_document const& doc)
+        {
+            std::copy(doc.chars.begin(), doc.chars.end(), chars.begin());
+            std::copy(doc.texts.begin(), doc.texts.end(), texts.begin());
+            std::copy(doc.variables.begin(), doc.variables.end(), variables.begin());
+            std::copy(doc.blocks.begin(), doc.blocks.end(), blocks.begin());
+            std::copy(doc.partials.begin(), doc.partials.end(), partials.begin());
+            std::copy(doc.overriders.begin(), doc.overriders.end(), overriders.begin());
+            std::copy(doc.segments.begin(), doc.segments.end(), segments.begin());
+            std::copy(doc.contents.begin(), doc.contents.end(), contents.begin());
+            root = doc.root;
+        }
+
+        // Bytes taken by the containers of the document, with the worst
+        // alignment padding of each allocation.
+        static constexpr std::size_t bytes =
+            N.texts * sizeof(ast::text) +
+            N.variables * sizeof(ast::variable) +
+            N.blocks * sizeof(ast::block) +
+            N.partials * sizeof(ast::partial) +
+            N.overriders * sizeof(ast::override_map::value_type) +
+            N.segments * sizeof(key_descriptor) +
+            N.contents * sizeof(ast::content) +
+            (6 + N.blocks + N.partials + N.overriders) * alignof(std::max_align_t);
+
+        // Build the document over the arrays, the containers are allocated
+        // from `mr`.
+        ast::document document(std::pmr::memory_resource* mr) const
+        {
+            std::pmr::polymorphic_allocator<> alloc(mr);
+            auto const str = [this](static_range r)
+            {
+                return std::string_view(chars.data() + r.index, r.size);
+            };
+            auto const list = [&, this](static_range r)
+            {
+                auto const p = contents.data() + r.index;
+                return ast::content_list(p, p + r.size, alloc);
+            };
+            ast::document doc
+            {
+                {
+                    std::pmr::vector<ast::text>(alloc),
+                    std::pmr::vector<ast::variable>(alloc),
+                    std::pmr::vector<ast::block>(alloc),
+                    std::pmr::vector<ast::partial>(alloc),
+                    std::pmr::vector<key_descriptor>(alloc)
+                },
+                list(root)
+            };
+            auto& ctx = doc.ctx;
+            ctx.texts.reserve(N.texts);
+            for (auto const& text : texts)
+                ctx.texts.push_back(str(text));
+            ctx.variables.reserve(N.variables);
+            for (auto const& variable : variables)
+                ctx.variables.push_back({str(variable.key), variable.split, variable.path});
+            ctx.blocks.reserve(N.blocks);
+            for (auto const& block : blocks)
+                ctx.blocks.push_back({str(block.key), list(block.contents), block.path});
+            ctx.partials.reserve(N.partials);
+            for (auto const& partial : partials)
+            {
+                ast::override_map map(alloc);
+                map.reserve(partial.overriders.size);
+                for (unsigned k = 0; k != partial.overriders.size; ++k)
+                {
+                    auto const& pair = overriders[partial.overriders.index + k];
+                    map.emplace_back(str(pair.key), list(pair.contents));
+                }
+                ctx.partials.push_back({str(partial.key), str(partial.indent), std::move(map)});
+            }
+            ctx.segments.reserve(N.segments);
+            for (auto const& segment : segments)
+                ctx.segments.emplace_back(str(segment));
+            return doc;
+        }
+    };
+
+    template<fixed_string S>
+    struct static_format
+    {
+        static constexpr static_size size = static_document(S.view()).size();
+        static constexpr static_image<size> image{static_document(S.view())};
+
+        static format const& get()
+        {
+            alignas(std::max_align_t) static std::byte buffer[image.bytes];
+            static std::pmr::monotonic_buffer_resource mr(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+            static spec_slot specs[size.variables ? size.variables : 1];
+            static document_storage storage(image.document(&mr), specs);
+            static format const fmt(storage, static_t{});
+            return fmt;
+        }
+    };
+}
+
+namespace bustache
+{
+    inline namespace literals
+    {
+        // The template is parsed while compiling, a malformed one fails the
+        // build. The document is built on first use in static storage.
+        template<detail::fixed_string S>
+        format const& operator"" _sfmt()
+        {
+            return detail::static_format<S>::get();
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,474 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <bustache/editable_format.hpp>
+#include <bustache/detail/parser.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "simd.hpp"
+
+namespace bustache::detail
+{
+    using parser::I;
+    using parser::delim;
+
+    // The state of the parser before a step, i.e. a call of `parse_content`,
+    // in a content list. The list can be parsed again from any step, and
+    // the source is parsed the same from a step on if the state is the same.
+    struct edit_step
+    {
+        std::size_t i0; // Offsets in the source.
+        std::size_t i;
+        unsigned item; // The first item of the list made by the step.
+        unsigned delim;
+        bool pure;
+    };
+
+    struct block_steps
+    {
+        std::string_view section;
+        std::vector<edit_step> steps;
+    };
+
+    constexpr unsigned root_list = unsigned(-1);
+
+    struct edit_state
+    {
+        std::vector<char> text;
+        // Keys, indents, sections & delimiters.
+        std::pmr::monotonic_buffer_resource pool;
+        std::vector<delim> delims;
+        std::vector<edit_step> steps;
+        // The steps of each block in `ast::context::blocks`.
+        std::vector<block_steps> blocks;
+        // The number of nodes after the last full parse.
+        std::size_t full_size = 0;
+
+        std::string_view hold(std::string_view str, bool cstr)
+        {
+            if (str.empty() && !cstr)
+                return {};
+            auto const data = static_cast<char*>(pool.allocate(str.size() + cstr, 1));
+            std::memcpy(data, str.data(), str.size());
+            if (cstr)
+                data[str.size()] = '\0';
+            return {data, str.size()};
+        }
+
+        unsigned delim_id(delim const& d)
+        {
+            auto const n = unsigned(delims.size());
+            for (unsigned k = n; k--;)
+            {
+                if (delims[k].open == d.open && delims[k].close == d.close)
+                    return k;
+            }
+            delims.push_back({hold(d.open, false), hold(d.close, false)});
+            return n;
+        }
+
+        std::vector<edit_step>& steps_of(unsigned list)
+        {
+            return list == root_list ? steps : blocks[list].steps;
+        }
+    };
+
+    namespace
+    {
+        // Builds the nodes into the `ast::context`, and keeps the steps of
+        // the blocks in the `edit_state`.
+        struct edit_builder
+        {
+            using content_list = ast::content_list;
+            using block = ast::block;
+            using partial = ast::partial;
+
+            struct pending_step
+            {
+                content_list const* list;
+                std::string_view section;
+                edit_step step;
+            };
+
+            ast::context& ctx;
+            edit_state& state;
+            I base;
+            // The steps of the blocks being parsed, the innermost last.
+            std::vector<pending_step> pending{};
+
+            ast::content add(ast::text node)
+            {
+                return ctx.add(node);
+            }
+
+            ast::content add(ast::type kind, ast::variable&& node)
+            {
+                return ctx.add(kind, std::move(node));
+            }
+
+            ast::content add(ast::type kind, ast::block&& node)
+            {
+                auto const list = &node.contents;
+                auto const it = std::find_if(pending.rbegin(), pending.rend(), [list](pending_step const& p)
+                {
+                    return p.list != list;
+                }).base();
+                block_steps steps{state.hold(it->section, false), {}};
+                steps.steps.reserve(pending.end() - it);
+                for (auto p = it; p != pending.end(); ++p)
+                    steps.steps.push_back(p->step);
+                pending.erase(it, pending.end());
+                state.blocks.push_back(std::move(steps));
+                return ctx.add(kind, std::move(node));
+            }
+
+            ast::content add(ast::partial&& node)
+            {
+                return ctx.add(std::move(node));
+            }
+
+            template<ast::type K>
+            auto get_if(ast::content c)
+            {
+                return ctx.get_if<K>(c);
+            }
+
+            static I next(I i, I e, char c) noexcept
+            {
+                return simd::find_either(i, e, '\n', c);
+            }
+
+            static I find(I i, I e, char c) noexcept
+            {
+                return simd::find_either(i, e, c, c);
+            }
+
+            edit_step make_step(content_list const& list, I i0, I i, bool pure, delim const& d)
+            {
+                return {std::size_t(i0 - base), std::size_t(i - base), unsigned(list.size()), state.delim_id(d), pure};
+            }
+
+            void checkpoint(content_list const& list, std::string_view section, I i0, I i, bool pure, delim const& d)
+            {
+                pending.push_back({&list, section, make_step(list, i0, i, pure, d)});
+            }
+        };
+
+        // The source from `pos`, `removed` chars replaced by `inserted` chars.
+        struct text_edit
+        {
+            std::size_t pos;
+            std::size_t removed;
+            std::size_t inserted;
+
+            // Map an offset after the edit in the old source to the new one.
+            std::size_t shift(std::size_t offset) const noexcept
+            {
+                return offset < pos + removed ? offset : offset - removed + inserted;
+            }
+        };
+
+        struct node_counts
+        {
+            std::size_t texts;
+            std::size_t variables;
+            std::size_t blocks;
+            std::size_t partials;
+
+            explicit node_counts(ast::context const& ctx) noexcept
+              : texts(ctx.texts.size()), variables(ctx.variables.size())
+              , blocks(ctx.blocks.size()), partials(ctx.partials.size())
+            {}
+
+            std::size_t total() const noexcept
+            {
+                return texts + variables + blocks + partials;
+            }
+
+            void restore(ast::context& ctx, edit_state& state) const
+            {
+                ctx.texts.resize(texts);
+                ctx.variables.resize(variables);
+                ctx.blocks.resize(blocks);
+                ctx.partials.resize(partials);
+                state.blocks.resize(blocks);
+            }
+        };
+
+        struct reparser
+        {
+            ast::document& doc;
+            edit_state& state;
+            I b;
+            I e;
+            text_edit edit;
+            node_counts old;
+
+            ast::content_list& contents_of(unsigned list) const
+            {
+                return list == root_list ? doc.contents : doc.ctx.blocks[list].contents;
+            }
+
+            // Move the old nodes & steps to the new source.
+            void relocate() const
+            {
+                auto const old_text = state.text.data();
+                auto const n = std::size_t(e - b);
+                for (std::size_t k = 0; k != old.texts; ++k)
+                {
+                    // Texts in the edit are dropped, just keep them valid.
+                    auto& text = doc.ctx.texts[k];
+                    auto const pos = std::min(edit.shift(text.data() - old_text), n);
+                    text = {b + pos, std::min(text.size(), n - pos)};
+                }
+                auto const shift = [this](std::vector<edit_step>& steps)
+                {
+                    for (auto& step : steps)
+                    {
+                        step.i0 = edit.shift(step.i0);
+                        step.i = edit.shift(step.i);
+                    }
+                };
+                shift(state.steps);
+                for (std::size_t k = 0; k != old.blocks; ++k)
+                    shift(state.blocks[k].steps);
+            }
+
+            // Hold the strings and split the keys of the new nodes.
+            void store() const
+            {
+                auto& ctx = doc.ctx;
+                auto const split = [&ctx](std::string_view key, ast::path& path)
+                {
+                    path.index = unsigned(ctx.segments.size());
+                    parser::for_each_segment(key, [&ctx](std::string_view segment)
+                    {
+                        ctx.segments.emplace_back(segment);
+                    });
+                    path.size = unsigned(ctx.segments.size() - path.index);
+                };
+                for (auto k = old.variables; k != ctx.variables.size(); ++k)
+                {
+                    auto& variable = ctx.variables[k];
+                    variable.key = state.hold(variable.key, true);
+                    auto const n = variable.split;
+                    split(n ? variable.key.substr(0, n) : variable.key, variable.path);
+                }
+                for (auto k = old.blocks; k != ctx.blocks.size(); ++k)
+                {
+                    auto& block = ctx.blocks[k];
+                    block.key = state.hold(block.key, true);
+                    split(block.key, block.path);
+                }
+                for (auto k = old.partials; k != ctx.partials.size(); ++k)
+                {
+                    auto& partial = ctx.partials[k];
+                    partial.key = state.hold(partial.key, true);
+                    partial.indent = state.hold(partial.indent, false);
+                    for (auto& pair : partial.overriders)
+                        pair.first = state.hold(pair.first, true);
+                }
+            }
+
+            // Parse the list again from its `k`-th step (`start`), until the
+            // state is that of an old step after the edit, then put the new
+            // items & steps in place of those in between. Return false if
+            // the list ends before that.
+            bool operator()(unsigned list, std::size_t k, edit_step const start)
+            {
+                edit_builder ctx{doc.ctx, state, b};
+                parser::parser<edit_builder> p{ctx};
+                auto d = state.delims[start.delim];
+                auto pure = start.pure;
+                I i0 = b + start.i0;
+                I i = b + start.i;
+                auto const section = list == root_list ? std::string_view() : state.blocks[list].section;
+                ast::content_list items;
+                std::vector<edit_step> steps;
+                auto const old_steps = state.steps_of(list).size();
+                auto t = k + 1;
+                for (;;)
+                {
+                    auto const offset = std::size_t(i0 - b);
+                    if (offset >= edit.pos + edit.inserted)
+                    {
+                        auto const& old_list = state.steps_of(list);
+                        auto const old_offset = offset - edit.inserted + edit.removed;
+                        while (t < old_steps && old_list[t].i0 < old_offset)
+                            ++t;
+                        if (t < old_steps && old_list[t].i0 == old_offset &&
+                            edit.shift(old_list[t].i) == std::size_t(i - b) &&
+                            old_list[t].pure == pure && state.delims[old_list[t].delim].open == d.open &&
+                            state.delims[old_list[t].delim].close == d.close)
+                            break;
+                    }
+                    steps.push_back(ctx.make_step(items, i0, i, pure, d));
+                    steps.back().item += start.item;
+                    std::string_view text;
+                    ast::content a{};
+                    auto const end = p.parse_content(b, i0, i, e, d, pure, text, a, section);
+                    if (!text.empty())
+                        items.push_back(ctx.add(text));
+                    if (!a.is_null())
+                        items.push_back(a);
+                    if (end)
+                    {
+                        if (list != root_list)
+                            return false;
+                        t = old_steps;
+                        break;
+                    }
+                }
+                relocate();
+                auto& contents = contents_of(list);
+                auto& old_list = state.steps_of(list);
+                auto const first = contents.begin() + start.item;
+                auto const last = t == old_steps ? contents.end() : contents.begin() + old_list[t].item;
+                auto const shift = unsigned(items.size() - (last - first));
+                for (auto j = t; j != old_steps; ++j)
+                    old_list[j].item += shift;
+                contents.insert(contents.erase(first, last), items.begin(), items.end());
+                old_list.insert(old_list.erase(old_list.begin() + k, old_list.begin() + t), steps.begin(), steps.end());
+                store();
+                return true;
+            }
+        };
+    }
+}
+
+namespace bustache
+{
+    using detail::edit_state;
+    using detail::edit_step;
+
+    static void parse_all(ast::document& doc, edit_state& state)
+    {
+        doc = {};
+        state.delims.clear();
+        state.steps.clear();
+        state.blocks.clear();
+        state.pool.release();
+        auto const b = state.text.data();
+        auto const e = b + state.text.size();
+        detail::reparser reparse{doc, state, b, e, {0, 0, 0}, detail::node_counts(doc.ctx)};
+        edit_step const start{0, 0, 0, state.delim_id({"{{", "}}"}), true};
+        reparse(detail::root_list, 0, start);
+        state.full_size = detail::node_counts(doc.ctx).total();
+    }
+
+    editable_format::editable_format(std::string_view source)
+      : _state(std::make_unique<edit_state>())
+    {
+        _state->text.assign(source.begin(), source.end());
+        _fmt._storage = std::make_shared<detail::document_storage>();
+        _fmt._storage->edited = true;
+        parse_all(_fmt._storage->doc, *_state);
+        _fmt._storage->specs.reset(_fmt._storage->doc.ctx);
+    }
+
+    editable_format::editable_format(editable_format&& other) noexcept = default;
+
+    editable_format& editable_format::operator=(editable_format&& other) noexcept = default;
+
+    editable_format::~editable_format() = default;
+
+    std::string_view editable_format::source() const noexcept
+    {
+        return {_state->text.data(), _state->text.size()};
+    }
+
+    void editable_format::edit(std::size_t pos, std::size_t count, std::string_view str)
+    {
+        auto& state = *_state;
+        auto& doc = _fmt._storage->doc;
+        auto const& old_text = state.text;
+        if (pos > old_text.size())
+            throw std::out_of_range("editable_format::edit");
+        count = std::min(count, old_text.size() - pos);
+        std::vector<char> text;
+        text.reserve(old_text.size() - count + str.size());
+        text.insert(text.end(), old_text.begin(), old_text.begin() + pos);
+        text.insert(text.end(), str.begin(), str.end());
+        text.insert(text.end(), old_text.begin() + pos + count, old_text.end());
+
+        // Find the innermost list that can be parsed again from a step
+        // before the edit. The steps before it must not have read the edited
+        // source: they read up to where it starts, and on to the first
+        // non-space or newline when checking for a standalone tag.
+        auto const before = [&old_text, pos](edit_step const& step)
+        {
+            auto i = step.i;
+            while (i != old_text.size() && old_text[i] != '\n' && detail::parser::is_space(old_text[i]))
+                ++i;
+            return i < pos;
+        };
+        struct level
+        {
+            unsigned list;
+            std::size_t step;
+        };
+        std::vector<level> levels;
+        for (auto list = detail::root_list;;)
+        {
+            auto const& steps = state.steps_of(list);
+            auto const it = std::partition_point(steps.begin(), steps.end(), before);
+            if (it == steps.begin())
+            {
+                if (list != detail::root_list)
+                    break;
+                levels.push_back({list, 0});
+            }
+            else
+                levels.push_back({list, std::size_t(it - steps.begin() - 1)});
+            auto const k = levels.back().step;
+            auto const& contents = list == detail::root_list ? doc.contents : doc.ctx.blocks[list].contents;
+            auto const first = steps[k].item;
+            auto const last = k + 1 == steps.size() ? unsigned(contents.size()) : steps[k + 1].item;
+            auto next = list;
+            for (auto j = first; j != last; ++j)
+            {
+                auto const c = contents[j];
+                if (c.kind < ast::type::section || c.kind > ast::type::inheritance)
+                    continue;
+                auto const& block_steps = state.blocks[c.index].steps;
+                if (!block_steps.empty() && before(block_steps.front()))
+                    next = c.index;
+            }
+            if (next == list)
+                break;
+            list = next;
+        }
+
+        detail::node_counts const old(doc.ctx);
+        detail::reparser reparse{doc, state, text.data(), text.data() + text.size(), {pos, count, str.size()}, old};
+        try
+        {
+            for (auto level = levels.rbegin(); ; ++level)
+            {
+                // The step is copied since the steps may grow.
+                auto const step = state.steps_of(level->list)[level->step];
+                if (reparse(level->list, level->step, step))
+                    break;
+                old.restore(doc.ctx, state);
+            }
+        }
+        catch (...)
+        {
+            old.restore(doc.ctx, state);
+            _fmt._storage->specs.reset(doc.ctx);
+            throw;
+        }
+        state.text.swap(text);
+
+        // Parse it all again if the unused nodes outnumber the used ones.
+        if (detail::node_counts(doc.ctx).total() > 2 * state.full_size + 64)
+            parse_all(doc, state);
+        // The variables may have moved, so are their specs.
+        _fmt._storage->specs.reset(doc.ctx);
+    }
+}
@@ -5,491 +5,775 @@
     file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //////////////////////////////////////////////////////////////////////////////*/
 #include <cassert>
+#include <algorithm>
 #include <utility>
 #include <cstring>
 #include <exception>
-#include <bustache/format.hpp>
+#include <functional>
+#include <bustache/detail/parser.hpp>
+#include "simd.hpp"
 
 namespace bustache::parser { namespace
 {
-    using I = char const*;
+    using detail::parser::I;
 
-    struct delim
+    // The first stage of the parser. Each 64-byte block of the source is
+    // classified at once into a bitmask of the bytes that may start a tag
+    // (the first char of the open delimiter) or end a line, so that the
+    // recursive-descent stage can jump between these positions instead of
+    // testing every byte. The block is reclassified when the delimiter
+    // changes.
+    struct structural_index
     {
-        std::string_view open;
-        std::string_view close;
+        I base = nullptr;
+        I last = nullptr;
+        std::uint64_t bits = 0;
+        char open = '\0';
+
+        // Return the first position in [i, e) that is either '\n' or `c`.
+        I next(I i, I e, char c) noexcept
+        {
+            if (c == open && base <= i && i < last)
+            {
+                if (auto const m = bits & (~std::uint64_t(0) << (i - base)))
+                    return base + std::countr_zero(m);
+                i = last;
+            }
+            while (i != e)
+            {
+                auto const n = std::min(std::size_t(e - i), detail::simd::block_size);
+                base = i;
+                last = i + n;
+                open = c;
+                bits = detail::simd::match_mask(i, n, '\n', c);
+                if (bits)
+                    return i + std::countr_zero(bits);
+                i = last;
+            }
+            return e;
+        }
     };
 
-    constexpr bool is_space(char c)
+    // Builds the nodes into the `ast::context`.
+    struct builder
     {
-        switch (c)
+        using content_list = ast::content_list;
+        using block = ast::block;
+        using partial = ast::partial;
+
+        ast::context& ctx;
+        structural_index index{};
+
+        template<class... T>
+        ast::content add(T&&... node)
         {
-        case ' ':
-        case '\f':
-        case '\n':
-        case '\r':
-        case '\t':
-        case '\v':
-            return true;
+            return ctx.add(std::forward<T>(node)...);
+        }
+
+        template<ast::type K>
+        auto get_if(ast::content c)
+        {
+            return ctx.get_if<K>(c);
+        }
+
+        I next(I i, I e, char c) noexcept
+        {
+            return index.next(i, e, c);
         }
-        return false;
-    }
 
-    // Return true if it ends.
-    inline bool skip(I& i, I e) noexcept
+        static I find(I i, I e, char c) noexcept
+        {
+            return detail::simd::find_either(i, e, c, c);
+        }
+    };
+}}
+
+namespace bustache
+{
+    static char const* get_error_string(error_type err) noexcept
     {
-        while (i != e)
+        switch (err)
         {
-            if (!is_space(*i))
-                return false;
-            ++i;
+        case error_set_delim:
+            return "mismatched '='";
+        case error_baddelim:
+            return "invalid delimiter";
+        case error_delim:
+            return "mismatched delimiter";
+        case error_section:
+            return "mismatched end section tag";
+        case error_badkey:
+            return "invalid key";
+        case error_badspec:
+            return "invalid format spec";
+        case error_badimage:
+            return "invalid image";
+        default:
+            assert(!"should not happen");
+            std::terminate();
         }
-        return true;
     }
 
-    inline bool parse_sentinel(I& i, I e, char c) noexcept
+    format_error::format_error(error_type err, std::ptrdiff_t pos)
+      : runtime_error(get_error_string(err)), _err(err), _pos(pos)
+    {}
+
+    void format::init(char const* begin, char const* end)
+    {
+        auto& doc = _storage->doc;
+        parser::builder ctx{doc.ctx};
+        detail::parser::parser<parser::builder>{ctx}.parse_start(begin, end, doc.contents);
+    }
+
+    // Call `f` on every string referenced by the document. Keys are followed
+    // by '\0' in the storage since the format spec after the split is handed
+    // out as a C string.
+    template<class F>
+    static void for_each_string(ast::document& doc, bool texts, F f)
     {
-        if (i != e && *i == c)
+        if (texts)
+        {
+            for (auto& text : doc.ctx.texts)
+                f(text, false);
+        }
+        for (auto& variable : doc.ctx.variables)
+            f(variable.key, true);
+        for (auto& block : doc.ctx.blocks)
+            f(block.key, true);
+        for (auto& partial : doc.ctx.partials)
         {
-            skip(++i, e);
-            return true;
+            f(partial.key, true);
+            f(partial.indent, false);
+            for (auto& pair : partial.overriders)
+                f(pair.first, true);
         }
-        return false;
     }
 
-    inline bool parse_lit(I& i, I e, std::string_view str) noexcept
+    static std::size_t string_size(ast::document& doc, bool texts)
     {
-        if (e - i < std::ptrdiff_t(str.size()))
-            return false;
-        I p = i;
-        for (char c : str)
+        std::size_t n = 0;
+        for_each_string(doc, texts, [&n](std::string_view s, bool cstr)
         {
-            if (*p != c)
-                return false;
-            ++p;
-        }
-        i = p;
-        return true;
+            n += s.size() + cstr;
+        });
+        return n;
     }
 
-    unsigned expect_key(I b, I& i, I e, delim& d, std::string& attr, char sentinel)
+    static void copy_strings(ast::document& doc, bool texts, char* data)
     {
-        unsigned split = 0;
-        skip(i, e);
-        for (I const i0 = i; i != e; ++i)
+        for_each_string(doc, texts, [&data](std::string_view& s, bool cstr)
         {
-            I const i1 = i;
-            skip(i, e);
-            if (!sentinel || parse_sentinel(i, e, sentinel))
-            {
-                if (parse_lit(i, e, d.close))
-                {
-                    if (split ? split + 1 == i1 - i0 : i0 == i1) [[unlikely]]
-                        break;
-                    attr.assign(i0, i1);
-                    return split;
-                }
-            }
-            if (i == e) [[unlikely]]
-                break;
-            if (!split && *i == ':')
-            {
-                split = unsigned(i - i0);
-                if (!split) [[unlikely]]
-                    break;
-            }
+            auto const n = s.size();
+            if (n)
+                std::memcpy(data, s.data(), n);
+            s = {data, n};
+            data += n;
+            if (cstr)
+                *data++ = '\0';
+        });
+    }
+
+    template<class F>
+    static void for_each_path(ast::document& doc, F f)
+    {
+        for (auto& variable : doc.ctx.variables)
+        {
+            auto const split = variable.split;
+            f(split ? variable.key.substr(0, split) : variable.key, variable.path);
         }
-        throw format_error(error_badkey, i - b);
+        for (auto& block : doc.ctx.blocks)
+            f(block.key, block.path);
     }
 
-    struct pure_result
+    static std::size_t count_segments(ast::document& doc)
     {
-        I start;
-        bool standalone;
-    };
+        std::size_t n = 0;
+        for_each_path(doc, [&n](std::string_view key, ast::path)
+        {
+            n += std::count(key.begin(), key.end(), '.') + 1;
+        });
+        return n;
+    }
 
-    pure_result process_pure(I& i, I e, bool pure) noexcept
+    // Split the (stored) keys on '.' once, so that the renderer can walk the
+    // nested objects without scanning the keys again.
+    static void split_paths(ast::document& doc)
     {
-        pure_result ret{i, pure};
-        if (pure)
+        auto& segments = doc.ctx.segments;
+        segments.clear();
+        segments.reserve(count_segments(doc));
+        for_each_path(doc, [&segments](std::string_view key, ast::path& path)
         {
-            while (i != e)
+            path.index = unsigned(segments.size());
+            detail::parser::for_each_segment(key, [&segments](std::string_view segment)
             {
-                if (*i == '\n')
-                {
-                    ret.start = ++i;
-                    break;
-                }
-                else if (is_space(*i))
-                    ++i;
-                else
-                {
-                    ret.standalone = false;
-                    break;
-                }
-            }
-        }
-        return ret;
+                segments.emplace_back(segment);
+            });
+            path.size = unsigned(segments.size() - path.index);
+        });
     }
 
-    struct tag_result
+    void format::store(bool copytext)
     {
-        bool is_end_section;
-        bool check_standalone;
-        bool is_standalone;
-    };
+        auto& storage = *_storage;
+        storage.copytext = copytext;
+        if (auto const n = string_size(storage.doc, copytext))
+        {
+            auto const data = new char[n];
+            storage.text.reset(data);
+            copy_strings(storage.doc, copytext, data);
+        }
+        split_paths(storage.doc);
+        storage.specs.reset(storage.doc.ctx);
+    }
 
-    struct parser
+    void format::copy_edited(format const& other)
     {
-        ast::context& ctx;
+        // The source is edited in place too, so the texts are copied.
+        _storage = std::make_shared<detail::document_storage>(ast::document(other.doc()));
+        _program.reset();
+        _binding.reset();
+        _escaping.reset();
+        store(true);
+    }
 
-        void parse_start(I& i, I e, ast::content_list& attr)
+    namespace
+    {
+        struct relocator
         {
-            delim d{"{{", "}}"};
-            bool pure = true;
-            parse_contents(i, i, i, e, d, pure, attr, {});
-        }
+            std::pmr::polymorphic_allocator<> alloc;
 
-        bool parse_content
-        (
-            I b, I& i0, I& i, I e, delim& d, bool& pure,
-            std::string_view& text, ast::content& attr,
-            std::string_view section
-        );
+            static std::size_t bytes(ast::content_list const& contents) noexcept
+            {
+                return contents.size() * sizeof(ast::content) + alignof(std::max_align_t);
+            }
 
-        void parse_contents
-        (
-            I b, I i0, I& i, I e, delim& d, bool& pure,
-            ast::content_list& attr, std::string_view section
-        );
+            template<class T>
+            static std::size_t bytes(std::pmr::vector<T> const& nodes) noexcept
+            {
+                return nodes.size() * sizeof(T) + alignof(std::max_align_t);
+            }
 
-        bool expect_block(I b, I& i, I e, delim& d, bool& pure, ast::block& attr)
-        {
-            std::string key;
-            auto const split = expect_key(b, i, e, d, key, '\0');
-            auto const [i0, standalone] = process_pure(i, e, pure);
-            std::string_view section;
-            if (split)
+            static std::size_t bytes(ast::document const& doc) noexcept
             {
-                attr.key = key.substr(split + 1);
-                section = std::string_view(key.data(), split);
+                auto const& ctx = doc.ctx;
+                auto n = bytes(ctx.texts) + bytes(ctx.variables) + bytes(ctx.blocks) +
+                    bytes(ctx.partials) + bytes(doc.contents);
+                for (auto const& block : ctx.blocks)
+                    n += bytes(block.contents);
+                for (auto const& partial : ctx.partials)
+                {
+                    n += bytes(partial.overriders);
+                    for (auto const& pair : partial.overriders)
+                        n += bytes(pair.second);
+                }
+                return n;
             }
-            else
+
+            ast::content_list operator()(ast::content_list const& contents) const
             {
-                attr.key = std::move(key);
-                section = attr.key;
+                return {contents.begin(), contents.end(), alloc};
+            }
+
+            ast::override_map operator()(ast::override_map const& map) const
+            {
+                ast::override_map ret(alloc);
+                ret.reserve(map.size());
+                for (auto const& pair : map)
+                    ret.emplace_back(pair.first, (*this)(pair.second));
+                return ret;
             }
-            parse_contents(b, i0, i, e, d, pure, attr.contents, section);
-            return standalone;
-        }
 
-        bool expect_inheritance(I b, I& i, I e, delim& d, bool& pure, ast::partial& attr);
+            template<class T, class F>
+            std::pmr::vector<T> operator()(std::pmr::vector<T> const& nodes, F f) const
+            {
+                std::pmr::vector<T> ret(alloc);
+                ret.reserve(nodes.size());
+                for (auto const& node : nodes)
+                    ret.push_back(f(node));
+                return ret;
+            }
 
-        tag_result expect_tag
-        (
-            I b, I& i, I e, delim& d, bool& pure,
-            ast::content& attr, std::string_view section
-        );
-    };
+            ast::document operator()(ast::document const& doc) const
+            {
+                auto const& ctx = doc.ctx;
+                return
+                {
+                    {
+                        (*this)(ctx.texts, std::identity{}),
+                        (*this)(ctx.variables, std::identity{}),
+                        (*this)(ctx.blocks, [this](ast::block const& block)
+                        {
+                            return ast::block{block.key, (*this)(block.contents), block.path, block.text_only};
+                        }),
+                        (*this)(ctx.partials, [this](ast::partial const& partial)
+                        {
+                            return ast::partial{partial.key, partial.indent, (*this)(partial.overriders)};
+                        }),
+                        std::pmr::vector<key_descriptor>(alloc)
+                    },
+                    (*this)(doc.contents)
+                };
+            }
+        };
+    }
 
-    bool parser::expect_inheritance(I b, I& i, I e, delim& d, bool& pure, ast::partial& attr)
+    void format::store_in_arena()
     {
-        expect_key(b, i, e, d, attr.key, '\0');
-        auto [i0, standalone] = process_pure(i, e, pure);
-        for (std::string_view text;;)
-        {
-            ast::content a;
-            auto const end = parse_content(b, i0, i, e, d, pure, text, a, attr.key);
-            if (auto const p = ctx.get_if<ast::type::inheritance>(a))
-                attr.overriders.emplace(std::move(p->key), std::move(p->contents));
-            if (end)
-                break;
-        }
-        return standalone;
+        // Size the arena up front so that the whole document, including the
+        // copied texts and keys, is carved out of one upstream allocation.
+        auto& storage = *_storage;
+        auto const n = string_size(storage.doc, true);
+        auto const segments = count_segments(storage.doc) * sizeof(key_descriptor) + alignof(std::max_align_t);
+        storage.arena = std::make_unique<std::pmr::monotonic_buffer_resource>(relocator::bytes(storage.doc) + segments + n);
+        relocator reloc{storage.arena.get()};
+        auto doc = reloc(storage.doc);
+        std::destroy_at(&storage.doc);
+        std::construct_at(&storage.doc, std::move(doc));
+        storage.copytext = true;
+        storage.text.reset();
+        if (n)
+            copy_strings(storage.doc, true, reloc.alloc.allocate_object<char>(n));
+        split_paths(storage.doc);
+        storage.specs.reset(storage.doc.ctx);
     }
 
-    void expect_comment(I b, I& i, I e, delim& d)
+    namespace
     {
-        while (!parse_lit(i, e, d.close))
+        bool is_html_space(char c) noexcept
         {
-            if (i == e)
-                throw format_error(error_delim, i - b);
-            ++i;
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
         }
-    }
 
-    void expect_set_delim(I b, I& i, I e, delim& d)
-    {
-        skip(i, e);
-        I i0 = i;
-        for (;;)
+        char to_lower(char c) noexcept
         {
-            if (i == e)
-                throw format_error(error_baddelim, i - b);
-            if (is_space(*i))
-                break;
-            ++i;
+            return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
         }
-        d.open = std::string_view(i0, i - i0);
-        skip(i, e);
-        i0 = i;
-        I i1 = i;
-        for (;; ++i)
+
+        bool is_url_attribute(std::string_view name) noexcept
         {
-            if (i == e)
-                throw format_error(error_set_delim, i - b);
-            if (*i == '=')
+            for (std::string_view const attr : {"href", "src", "action", "formaction", "cite", "poster", "background", "data", "codebase", "xlink:href"})
             {
-                i1 = i;
-                break;
-            }
-            if (is_space(*i))
-            {
-                i1 = i;
-                if (skip(++i, e) || *i != '=')
-                    throw format_error(error_set_delim, i - b);
-                break;
+                if (name == attr)
+                    return true;
             }
+            return false;
         }
-        if (i0 == i1)
-            throw format_error(error_baddelim, i - b);
-        skip(++i, e);
-        if (!parse_lit(i, e, d.close))
-            throw format_error(error_delim, i - b);
-        d.close = std::string_view(i0, i1 - i0);
-    }
 
-    tag_result parser::expect_tag
-    (
-        I b, I& i, I e, delim& d, bool& pure,
-        ast::content& attr, std::string_view section
-    )
-    {
-        if (skip(i, e))
-            throw format_error(error_badkey, i - b);
-        tag_result ret{};
-        ast::type kind;
-        switch (*i)
+        // Follow a script far enough to tell if it's in a string literal.
+        // A variable that is not, e.g. in a template literal or a comment,
+        // is output as a quoted string.
+        struct script_scanner
         {
-        case '#':
-            kind = ast::type::section;
+            enum class state
             {
-            block:
-                ast::block a;
-                ret.is_standalone = expect_block(b, ++i, e, d, pure, a);
-                attr = ctx.add(kind, std::move(a));
+                code,
+                dq,
+                sq,
+                bq,
+                line_comment,
+                block_comment,
+                regex,
+                regex_class
+            };
+
+            state at = state::code;
+            // The last char of the code that's not a space, which tells a
+            // regex from a division.
+            char last = 0;
+            bool escaped = false;
+            // A '/' in the code or a '*' in a comment.
+            bool pending = false;
+
+            bool in_string() const noexcept
+            {
+                return at == state::dq || at == state::sq;
             }
-            break;
-        case '^':
-            kind = ast::type::inversion;
-            goto block;
-        case '?':
-            kind = ast::type::filter;
-            goto block;
-        case '*':
-            kind = ast::type::loop;
-            goto block;
-        case '$':
-            kind = ast::type::inheritance;
-            goto block;
-        case '/':
-            skip(++i, e);
-            if (!parse_lit(i, e, section))
-                throw format_error(error_section, i - b);
-            skip(i, e);
-            if (!parse_lit(i, e, d.close))
-                throw format_error(error_delim, i - b);
-            ret.check_standalone = pure;
-            ret.is_end_section = true;
-            break;
-        case '!':
-        {
-            expect_comment(b, ++i, e, d);
-            ret.check_standalone = pure;
-            break;
-        }
-        case '=':
-        {
-            expect_set_delim(b, ++i, e, d);
-            ret.check_standalone = pure;
-            break;
-        }
-        case '>':
-        {
-            ast::partial a;
-            expect_key(b, ++i, e, d, a.key, '\0');
-            attr = ctx.add(std::move(a));
-            ret.check_standalone = pure;
-            break;
-        }
-        case '&':
-        case '{':
-        {
-            ast::variable a;
-            char const sentinel = *i == '{' ? '}' : '\0';
-            a.split = expect_key(b, ++i, e, d, a.key, sentinel);
-            attr = ctx.add(ast::type::var_raw, std::move(a));
-            pure = false;
-            break;
-        }
-        // Extensions
-        case '<':
-        {
-            ast::partial a;
-            ret.is_standalone = expect_inheritance(b, ++i, e, d, pure, a);
-            attr = ctx.add(std::move(a));
-            return ret;
-        }
-        default:
-            ast::variable a;
-            a.split = expect_key(b, i, e, d, a.key, '\0');
-            attr = ctx.add(ast::type::var_escaped, std::move(a));
-            pure = false;
-            break;
-        }
-        return ret;
-    }
 
-    // Return true if it ends.
-    bool parser::parse_content
-    (
-        I b, I& i0, I& i, I e, delim& d, bool& pure,
-        std::string_view& text, ast::content& attr,
-        std::string_view section
-    )
-    {
-        for (I i1 = i; i != e;)
-        {
-            if (*i == '\n')
+            // A variable is output.
+            void value() noexcept
             {
-                pure = true;
-                i1 = ++i;
+                if (at == state::code)
+                {
+                    last = '"';
+                    pending = false;
+                }
             }
-            else if (is_space(*i))
-                ++i;
-            else
+
+            bool regex_allowed() const noexcept
             {
-                I const i2 = i;
-                if (parse_lit(i, e, d.open))
+                return !last || std::string_view("(,=:[!&|?{};+-*%<>~^").find(last) != std::string_view::npos;
+            }
+
+            void feed(char c) noexcept
+            {
+                switch (at)
                 {
-                    tag_result tag(expect_tag(b, i, e, d, pure, attr, section));
-                    text = std::string_view(i0, i1 - i0);
-                    if (tag.check_standalone)
+                case state::code:
+                    if (pending)
                     {
-                        I const i3 = i;
-                        while (i != e)
+                        pending = false;
+                        if (c == '/')
+                            at = state::line_comment;
+                        else if (c == '*')
+                            at = state::block_comment;
+                        else if (regex_allowed())
                         {
-                            if (*i == '\n')
-                            {
-                                ++i;
-                                break;
-                            }
-                            else if (is_space(*i))
-                                ++i;
-                            else
-                            {
-                                pure = false;
-                                text = std::string_view(i0, i2 - i0);
-                                // For end-section, we move the current pos (i)
-                                // since i0 is local to the section and is not
-                                // propagated upwards.
-                                (tag.is_end_section ? i : i0) = i3;
-                                return tag.is_end_section;
-                            }
+                            at = state::regex;
+                            feed(c);
                         }
-                        tag.is_standalone = true;
+                        else
+                        {
+                            last = '/';
+                            feed(c);
+                        }
+                    }
+                    else if (c == '/')
+                        pending = true;
+                    else if (c == '"')
+                        at = state::dq;
+                    else if (c == '\'')
+                        at = state::sq;
+                    else if (c == '`')
+                        at = state::bq;
+                    else if (!is_html_space(c))
+                        last = c;
+                    break;
+                case state::dq:
+                case state::sq:
+                case state::bq:
+                    if (escaped)
+                        escaped = false;
+                    else if (c == '\\')
+                        escaped = true;
+                    else if (c == (at == state::dq ? '"' : at == state::sq ? '\'' : '`'))
+                    {
+                        at = state::code;
+                        last = '"';
+                    }
+                    else if (c == '\n' && at != state::bq)
+                        at = state::code;
+                    break;
+                case state::line_comment:
+                    if (c == '\n' || c == '\r')
+                        at = state::code;
+                    break;
+                case state::block_comment:
+                    if (pending && c == '/')
+                        at = state::code;
+                    pending = c == '*';
+                    break;
+                case state::regex:
+                case state::regex_class:
+                    if (escaped)
+                        escaped = false;
+                    else if (c == '\\')
+                        escaped = true;
+                    else if (c == '\n')
+                        at = state::code;
+                    else if (at == state::regex_class)
+                    {
+                        if (c == ']')
+                            at = state::regex;
+                    }
+                    else if (c == '[')
+                        at = state::regex_class;
+                    else if (c == '/')
+                    {
+                        at = state::code;
+                        last = ')';
                     }
-                    if (!tag.is_standalone)
-                        text = std::string_view(i0, i2 - i0);
-                    else if (auto const partial = ctx.get_if<ast::type::partial>(attr))
-                        partial->indent.assign(i1, i2 - i1);
-                    i0 = i;
-                    return i == e || tag.is_end_section;
+                    break;
                 }
-                else
+            }
+        };
+
+        // Follow the HTML of the texts, in the order of the source, far
+        // enough to tell the context of the variables between them.
+        struct html_scanner
+        {
+            enum class state
+            {
+                text,
+                tag_open,
+                tag_name,
+                in_tag,
+                attr_name,
+                after_attr_name,
+                before_value,
+                value_dq,
+                value_sq,
+                value_unq,
+                raw_text,
+                bang,
+                comment,
+                decl
+            };
+
+            ast::context const& ctx;
+            std::vector<detail::variable_escaping>& contexts;
+            state at = state::text;
+            // In `<script>` or an event handler attribute.
+            script_scanner script{};
+            std::string tag{};
+            std::string attr{};
+            bool closing = false;
+            bool value_start = false;
+            // The chars of "</tag" matched in a raw text, or of "--" in a
+            // comment.
+            std::size_t matched = 0;
+
+            void operator()(ast::content_list const& contents)
+            {
+                for (auto const content : contents)
+                    ctx.visit(*this, content);
+            }
+
+            void operator()(ast::type, void const*) {}
+
+            void operator()(ast::type, ast::text const* text)
+            {
+                for (auto const c : *text)
+                    feed(c);
+            }
+
+            void operator()(ast::type, ast::variable const* variable)
+            {
+                contexts[variable - ctx.variables.data()] = current();
+                // The output is part of the value it's in.
+                if (at == state::before_value)
+                    at = state::value_unq;
+                value_start = false;
+                script.value();
+            }
+
+            void operator()(ast::type, ast::block const* block)
+            {
+                (*this)(block->contents);
+            }
+
+            void operator()(ast::type, ast::partial const* partial)
+            {
+                // The partial itself starts in HTML text, the overriders
+                // are output where it is.
+                for (auto const& pair : partial->overriders)
                 {
-                    pure = false;
-                    ++i;
+                    auto copy = *this;
+                    copy(pair.second);
                 }
             }
-        }
-        text = std::string_view(i0, i - i0);
-        return true;
-    }
 
-    void parser::parse_contents
-    (
-        I b, I i0, I& i, I e, delim& d, bool& pure,
-        ast::content_list& attr, std::string_view section
-    )
-    {
-        for (;;)
-        {
-            std::string_view text;
-            ast::content a;
-            auto end = parse_content(b, i0, i, e, d, pure, text, a, section);
-            if (!text.empty())
-                attr.push_back(ctx.add(text));
-            if (!a.is_null())
-                attr.push_back(a);
-            if (end)
-                return;
-        }
-    }
-}}
+            escape_context script_context() const noexcept
+            {
+                return script.in_string() ? escape_context::script : escape_context::script_value;
+            }
 
-namespace bustache
-{
-    static char const* get_error_string(error_type err) noexcept
-    {
-        switch (err)
-        {
-        case error_set_delim:
-            return "mismatched '='";
-        case error_baddelim:
-            return "invalid delimiter";
-        case error_delim:
-            return "mismatched delimiter";
-        case error_section:
-            return "mismatched end section tag";
-        case error_badkey:
-            return "invalid key";
-        default:
-            assert(!"should not happen");
-            std::terminate();
-        }
-    }
+            detail::variable_escaping current() const noexcept
+            {
+                switch (at)
+                {
+                case state::text:
+                case state::bang:
+                case state::comment:
+                case state::decl:
+                    return {escape_context::html, escape_context::html};
+                case state::raw_text:
+                    return {tag == "script" ? script_context() : escape_context::style, escape_context::html};
+                case state::before_value:
+                case state::value_dq:
+                case state::value_sq:
+                case state::value_unq:
+                {
+                    auto const within = at == state::value_dq || at == state::value_sq ? escape_context::attribute : escape_context::unquoted;
+                    if (is_event_handler())
+                        return {script_context(), within};
+                    if (attr == "style")
+                        return {escape_context::style, within};
+                    // The start of a URL is not encoded, so that it can be
+                    // a whole URL, but its scheme is checked; what follows
+                    // is a component of it.
+                    if (is_url_attribute(attr))
+                        return {value_start ? escape_context::url_start : escape_context::url, within};
+                    return {within, escape_context::html};
+                }
+                default:
+                    // In a tag but not in a value, where any space or '='
+                    // would start another attribute.
+                    return {escape_context::unquoted, escape_context::html};
+                }
+            }
 
-    format_error::format_error(error_type err, std::ptrdiff_t pos)
-      : runtime_error(get_error_string(err)), _err(err), _pos(pos)
-    {}
+            bool is_event_handler() const noexcept
+            {
+                return attr.starts_with("on");
+            }
 
-    void format::init(char const* begin, char const* end)
-    {
-        parser::parser{_doc.ctx}.parse_start(begin, end, _doc.contents);
-    }
+            void end_tag() noexcept
+            {
+                at = !closing && (tag == "script" || tag == "style") ? state::raw_text : state::text;
+                matched = 0;
+                script = {};
+            }
 
-    std::size_t format::text_size() const noexcept
-    {
-        std::size_t n = 0;
-        for (auto const& text : _doc.ctx.texts)
-            n += text.size();
-        return n;
-    }
+            void start_value(state s) noexcept
+            {
+                at = s;
+                value_start = true;
+                script = {};
+            }
 
-    void format::copy_text(std::size_t n)
-    {
-        if (n)
-        {
-            auto data = new char[n];
-            _text.reset(data);
-            for (auto& text : _doc.ctx.texts)
+            void feed(char c)
             {
-                auto n = text.size();
-                std::memcpy(data, text.data(), n);
-                text = {data, n};
-                data += n;
+                switch (at)
+                {
+                case state::text:
+                    if (c == '<')
+                    {
+                        at = state::tag_open;
+                        tag.clear();
+                        closing = false;
+                    }
+                    break;
+                case state::tag_open:
+                    if (c == '/' && !closing)
+                        closing = true;
+                    else if (c == '!' && !closing)
+                    {
+                        at = state::bang;
+                        matched = 0;
+                    }
+                    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+                    {
+                        tag += to_lower(c);
+                        at = state::tag_name;
+                    }
+                    else
+                        at = state::text;
+                    break;
+                case state::tag_name:
+                    if (c == '>')
+                        end_tag();
+                    else if (is_html_space(c) || c == '/')
+                        at = state::in_tag;
+                    else
+                        tag += to_lower(c);
+                    break;
+                case state::in_tag:
+                    if (c == '>')
+                        end_tag();
+                    else if (!is_html_space(c) && c != '/')
+                    {
+                        attr.assign(1, to_lower(c));
+                        at = state::attr_name;
+                    }
+                    break;
+                case state::attr_name:
+                    if (c == '>')
+                        end_tag();
+                    else if (c == '=')
+                        start_value(state::before_value);
+                    else if (is_html_space(c))
+                        at = state::after_attr_name;
+                    else if (c == '/')
+                        at = state::in_tag;
+                    else
+                        attr += to_lower(c);
+                    break;
+                case state::after_attr_name:
+                    if (c == '>')
+                        end_tag();
+                    else if (c == '=')
+                        start_value(state::before_value);
+                    else if (!is_html_space(c) && c != '/')
+                    {
+                        attr.assign(1, to_lower(c));
+                        at = state::attr_name;
+                    }
+                    break;
+                case state::before_value:
+                    if (c == '>')
+                        end_tag();
+                    else if (c == '"')
+                        start_value(state::value_dq);
+                    else if (c == '\'')
+                        start_value(state::value_sq);
+                    else if (!is_html_space(c))
+                    {
+                        at = state::value_unq;
+                        value_start = false;
+                        if (is_event_handler())
+                            script.feed(c);
+                    }
+                    break;
+                case state::value_dq:
+                case state::value_sq:
+                    if (c == (at == state::value_dq ? '"' : '\''))
+                        at = state::in_tag;
+                    else
+                    {
+                        value_start = false;
+                        if (is_event_handler())
+                            script.feed(c);
+                    }
+                    break;
+                case state::value_unq:
+                    if (c == '>')
+                        end_tag();
+                    else if (is_html_space(c))
+                        at = state::in_tag;
+                    else if (is_event_handler())
+                        script.feed(c);
+                    break;
+                case state::raw_text:
+                    // Until "</script" or "</style".
+                    if (matched == tag.size() + 2)
+                    {
+                        if (c == '>' || is_html_space(c) || c == '/')
+                        {
+                            closing = true;
+                            at = state::tag_name;
+                            return feed(c);
+                        }
+                        matched = 0;
+                    }
+                    if (matched == 0 ? c == '<' : matched == 1 ? c == '/' : to_lower(c) == tag[matched - 2])
+                        ++matched;
+                    else
+                        matched = c == '<';
+                    if (tag == "script")
+                        script.feed(c);
+                    break;
+                case state::bang:
+                    if (c == '-' && ++matched == 2)
+                    {
+                        at = state::comment;
+                        matched = 0;
+                    }
+                    else if (c != '-')
+                        at = c == '>' ? state::text : state::decl;
+                    break;
+                case state::comment:
+                    if (c == '>' && matched >= 2)
+                        at = state::text;
+                    else
+                        matched = c == '-' ? matched + 1 : 0;
+                    break;
+                case state::decl:
+                    if (c == '>')
+                        at = state::text;
+                    break;
+                }
             }
-        }
+        };
+    }
+
+    void format::escape_by_context()
+    {
+        auto const& doc = this->doc();
+        auto e = std::make_shared<detail::escaping>();
+        e->ctx = &doc.ctx;
+        e->contexts.resize(doc.ctx.variables.size(), {escape_context::html, escape_context::html});
+        html_scanner{doc.ctx, e->contexts}(doc.contents);
+        _escaping = std::move(e);
     }
-}
\ No newline at end of file
+}
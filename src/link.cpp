@@ -0,0 +1,447 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <bustache/link.hpp>
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace bustache { namespace
+{
+    // Whether the renderer would write the indent before the next output,
+    // i.e. its `needs_indent`, as far as it's known ahead.
+    enum class line
+    {
+        mid,
+        start,
+        unknown
+    };
+
+    struct override_context
+    {
+        ast::override_map const* map;
+        ast::context const* ctx;
+    };
+
+    struct linker
+    {
+        context_handler context;
+        link_options const& options;
+        ast::context& ctx;
+        // The texts made, which don't move as more are added.
+        std::deque<std::string> held{};
+        // The overriders of the partials being inlined, outermost first.
+        std::vector<override_context> chain{};
+        std::vector<format const*> stack{};
+        // The overriders being expanded, which may refer to themselves in a
+        // section that the renderer won't expand endlessly.
+        std::vector<ast::content_list const*> expanding{};
+        // The partials being inlined, as an id for the path to them, which
+        // decides the indent & the overriders.
+        unsigned frame = 0;
+        std::map<std::pair<unsigned, ast::partial const*>, unsigned> frames{};
+        // The line after a list from a line, or none if it can't be added.
+        std::map<std::tuple<unsigned, ast::content_list const*, line>, std::optional<line>> ends{};
+        std::string key_cache{};
+
+        struct snapshot
+        {
+            std::size_t texts, variables, blocks, partials, out;
+        };
+
+        snapshot save(ast::content_list const& out) const
+        {
+            return {ctx.texts.size(), ctx.variables.size(), ctx.blocks.size(), ctx.partials.size(), out.size()};
+        }
+
+        // Drop the nodes added since, which nothing else refers to, as a
+        // block is added after its contents.
+        void restore(snapshot const& s, ast::content_list& out)
+        {
+            ctx.texts.resize(s.texts);
+            ctx.variables.resize(s.variables);
+            ctx.blocks.resize(s.blocks);
+            ctx.partials.resize(s.partials);
+            out.resize(s.out);
+        }
+
+        std::string_view hold(std::string str)
+        {
+            return held.emplace_back(std::move(str));
+        }
+
+        // The outermost overrider wins, i.e. the one of the partial used
+        // first, as the renderer looks them up.
+        ast::content_list const* find_override(std::string_view key, ast::context const*& src) const
+        {
+            for (auto const pm : chain)
+            {
+                auto const it = pm.map->find(key);
+                if (it != pm.map->end())
+                {
+                    src = pm.ctx;
+                    return &it->second;
+                }
+            }
+            return nullptr;
+        }
+
+        // Add the contents of `src` rendered with `indent`, or return false
+        // if the indent can't be applied ahead.
+        bool contents(ast::context const& src, ast::content_list const& in, std::string const& indent, line& state, ast::content_list& out)
+        {
+            for (auto const content : in)
+            {
+                switch (content.kind)
+                {
+                case ast::type::text:
+                    if (!text(src.texts[content.index], indent, state, out))
+                        return false;
+                    break;
+                case ast::type::var_escaped:
+                case ast::type::var_raw:
+                {
+                    if (!indent.empty())
+                    {
+                        if (state == line::unknown)
+                            return false;
+                        if (state == line::start)
+                            out.push_back(ctx.add(ast::text(hold(indent))));
+                    }
+                    state = line::mid;
+                    auto const& var = src.variables[content.index];
+                    out.push_back(ctx.add(content.kind, ast::variable{var.key, var.split, {}}));
+                    break;
+                }
+                case ast::type::section:
+                case ast::type::inversion:
+                case ast::type::filter:
+                case ast::type::loop:
+                    if (!section(src, content, indent, state, out))
+                        return false;
+                    break;
+                case ast::type::inheritance:
+                {
+                    auto const& b = src.blocks[content.index];
+                    auto from = &src;
+                    auto const found = find_override(b.key, from);
+                    auto const& list = found ? *found : b.contents;
+                    // Keep the partial it's from, as the recursive ones.
+                    if (found && std::find(expanding.begin(), expanding.end(), found) != expanding.end())
+                        return false;
+                    if (found)
+                        expanding.push_back(found);
+                    auto const ok = inheritance(*from, content, b.key, list, indent, state, out);
+                    if (found)
+                        expanding.pop_back();
+                    if (!ok)
+                        return false;
+                    break;
+                }
+                case ast::type::partial:
+                    if (!partial(src, src.partials[content.index], indent, state, out))
+                        return false;
+                    break;
+                case ast::type::null:
+                    out.push_back(content);
+                    break;
+                }
+            }
+            return true;
+        }
+
+        bool inheritance(ast::context const& src, ast::content content, std::string_view key, ast::content_list const& list, std::string const& indent, line& state, ast::content_list& out)
+        {
+            if (!options.overridable)
+            {
+                // Resolved for good, the contents take its place.
+                return contents(src, list, indent, state, out);
+            }
+            // A block in an indented partial could be overridden by the user
+            // of the result, whose contents wouldn't be indented.
+            if (!indent.empty())
+                return false;
+            ast::block block{key, {}, {}};
+            if (!contents(src, list, indent, state, block.contents))
+                return false;
+            out.push_back(ctx.add(content.kind, std::move(block)));
+            return true;
+        }
+
+        // Copy the contents as is, which is how the overriders of a partial
+        // kept are, as they may refer to the partials being inlined.
+        void copy(ast::context const& src, ast::content_list const& in, ast::content_list& out)
+        {
+            for (auto const content : in)
+            {
+                src.visit([&]<class Node>(ast::type kind, Node const* node)
+                {
+                    if constexpr (std::is_same_v<Node, ast::text>)
+                        out.push_back(ctx.add(*node));
+                    else if constexpr (std::is_same_v<Node, ast::variable>)
+                        out.push_back(ctx.add(kind, ast::variable{node->key, node->split, {}}));
+                    else if constexpr (std::is_same_v<Node, ast::block>)
+                    {
+                        ast::block block{node->key, {}, {}};
+                        copy(src, node->contents, block.contents);
+                        out.push_back(ctx.add(kind, std::move(block)));
+                    }
+                    else if constexpr (std::is_same_v<Node, ast::partial>)
+                    {
+                        ast::partial partial{node->key, node->indent, {}};
+                        for (auto const& [key, list] : node->overriders)
+                            copy(src, list, partial.overriders.emplace_back(key, ast::content_list{}).second);
+                        out.push_back(ctx.add(std::move(partial)));
+                    }
+                    else
+                        out.push_back(content);
+                }, content);
+            }
+        }
+
+        bool text(ast::text text, std::string const& indent, line& state, ast::content_list& out)
+        {
+            // The line is tracked without an indent too, as the result may
+            // be rendered with one as a partial.
+            if (indent.empty())
+            {
+                out.push_back(ctx.add(text));
+                state = text.back() == '\n' ? line::start : line::mid;
+                return true;
+            }
+            if (state == line::unknown)
+                return false;
+            std::string str;
+            if (state == line::start)
+                str = indent;
+            auto const last = text.size() - 1; // Not after the last newline.
+            for (std::size_t i = 0; i != text.size(); ++i)
+            {
+                str += text[i];
+                if (text[i] == '\n' && i != last)
+                    str += indent;
+            }
+            state = text.back() == '\n' ? line::start : line::mid;
+            out.push_back(ctx.add(ast::text(hold(std::move(str)))));
+            return true;
+        }
+
+        // Follow the line through the contents as `contents` does, without
+        // adding them, so that a section is added once.
+        bool advance(ast::context const& src, ast::content_list const& in, std::string const& indent, line& state)
+        {
+            auto const key = std::tuple(frame, &in, state);
+            if (auto const it = ends.find(key); it != ends.end())
+            {
+                if (!it->second)
+                    return false;
+                state = *it->second;
+                return true;
+            }
+            auto after = state;
+            auto const ok = advance_each(src, in, indent, after);
+            ends.emplace(key, ok ? std::optional(after) : std::nullopt);
+            if (ok)
+                state = after;
+            return ok;
+        }
+
+        bool advance_each(ast::context const& src, ast::content_list const& in, std::string const& indent, line& state)
+        {
+            for (auto const content : in)
+            {
+                switch (content.kind)
+                {
+                case ast::type::text:
+                case ast::type::var_escaped:
+                case ast::type::var_raw:
+                    if (!indent.empty() && state == line::unknown)
+                        return false;
+                    state = content.kind == ast::type::text && src.texts[content.index].back() == '\n' ? line::start : line::mid;
+                    break;
+                case ast::type::section:
+                case ast::type::inversion:
+                case ast::type::filter:
+                case ast::type::loop:
+                {
+                    auto const& list = src.blocks[content.index].contents;
+                    auto after = state;
+                    if (!advance(src, list, indent, after))
+                        return false;
+                    if (after != state)
+                    {
+                        after = line::unknown;
+                        if (!advance(src, list, indent, after))
+                            return false;
+                        if (after != state)
+                            state = line::unknown;
+                    }
+                    break;
+                }
+                case ast::type::inheritance:
+                {
+                    auto const& b = src.blocks[content.index];
+                    auto from = &src;
+                    auto const found = find_override(b.key, from);
+                    if (found && std::find(expanding.begin(), expanding.end(), found) != expanding.end())
+                        return false;
+                    if (options.overridable && !indent.empty())
+                        return false;
+                    if (found)
+                        expanding.push_back(found);
+                    auto const ok = advance(*from, found ? *found : b.contents, indent, state);
+                    if (found)
+                        expanding.pop_back();
+                    if (!ok)
+                        return false;
+                    break;
+                }
+                case ast::type::partial:
+                {
+                    auto const& p = src.partials[content.index];
+                    if (auto const fmt = inlined(p, state))
+                    {
+                        auto const& doc = fmt->doc();
+                        if (doc.contents.empty())
+                            break;
+                        auto after = state;
+                        auto const parent = enter(src, p, fmt);
+                        auto const ok = advance(doc.ctx, doc.contents, indent + std::string(p.indent), after);
+                        leave(parent);
+                        if (ok)
+                        {
+                            state = after;
+                            break;
+                        }
+                    }
+                    if (!indent.empty() && p.indent.empty() && state != line::start)
+                        return false;
+                    state = line::unknown;
+                    break;
+                }
+                case ast::type::null:
+                    break;
+                }
+            }
+            return true;
+        }
+
+        // A section is expanded any times, so its contents must end on the
+        // line they start on, or not depend on it.
+        bool section(ast::context const& src, ast::content content, std::string const& indent, line& state, ast::content_list& out)
+        {
+            auto const& b = src.blocks[content.index];
+            auto after = state;
+            if (!advance(src, b.contents, indent, after))
+                return false;
+            if (after != state)
+                after = line::unknown;
+            ast::block block{b.key, {}, {}};
+            if (!contents(src, b.contents, indent, after, block.contents))
+                return false;
+            if (after != state)
+                state = line::unknown;
+            out.push_back(ctx.add(content.kind, std::move(block)));
+            return true;
+        }
+
+        // The format of the partial if it can be inlined from the line.
+        format const* inlined(ast::partial const& p, line state)
+        {
+            key_cache.assign(p.key);
+            auto const fmt = context(key_cache);
+            // A generated format has no nodes to inline.
+            if (fmt && fmt->compiled() && fmt->doc().contents.empty())
+                return nullptr;
+            // The renderer starts a line for a partial with an indent, which
+            // can't be done ahead unless it's started already.
+            if (fmt && (p.indent.empty() || state == line::start)
+                && std::find(stack.begin(), stack.end(), fmt) == stack.end())
+                return fmt;
+            return nullptr;
+        }
+
+        // Return the frame to go back to.
+        unsigned enter(ast::context const& src, ast::partial const& p, format const* fmt)
+        {
+            chain.push_back({&p.overriders, &src});
+            stack.push_back(fmt);
+            auto const parent = frame;
+            frame = frames.try_emplace({parent, &p}, unsigned(frames.size() + 1)).first->second;
+            return parent;
+        }
+
+        void leave(unsigned parent)
+        {
+            chain.pop_back();
+            stack.pop_back();
+            frame = parent;
+        }
+
+        bool partial(ast::context const& src, ast::partial const& p, std::string const& indent, line& state, ast::content_list& out)
+        {
+            if (auto const fmt = inlined(p, state))
+            {
+                auto const& doc = fmt->doc();
+                if (doc.contents.empty())
+                    return true;
+                auto const s = save(out);
+                auto after = state;
+                auto const parent = enter(src, p, fmt);
+                auto const ok = contents(doc.ctx, doc.contents, indent + std::string(p.indent), after, out);
+                leave(parent);
+                if (ok)
+                {
+                    state = after;
+                    return true;
+                }
+                restore(s, out);
+            }
+            // The renderer starts a line for the partial kept only if it has
+            // an indent of its own.
+            if (!indent.empty() && p.indent.empty() && state != line::start)
+                return false;
+            // Keep it with the overriders of the partials inlined, which the
+            // renderer looks up first.
+            ast::partial node{p.key, hold(indent + std::string(p.indent)), {}};
+            auto const merge = [&](ast::context const& from, ast::override_map const& map)
+            {
+                for (auto const& [key, list] : map)
+                {
+                    if (node.overriders.find(key) != node.overriders.end())
+                        continue;
+                    copy(from, list, node.overriders.emplace_back(key, ast::content_list{}).second);
+                }
+            };
+            for (auto const pm : chain)
+                merge(*pm.ctx, *pm.map);
+            merge(src, p.overriders);
+            state = line::unknown;
+            out.push_back(ctx.add(std::move(node)));
+            return true;
+        }
+    };
+}}
+
+namespace bustache
+{
+    format link(format const& fmt, context_handler context, link_options const& options)
+    {
+        ast::document doc;
+        linker l{context, options, doc.ctx};
+        l.stack.push_back(&fmt);
+        auto state = line::start;
+        [[maybe_unused]] auto const ok = l.contents(fmt.doc().ctx, fmt.doc().contents, {}, state, doc.contents);
+        assert(ok && "nothing to indent");
+        return format(std::move(doc), true);
+    }
+}
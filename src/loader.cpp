@@ -0,0 +1,284 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <bustache/loader.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+
+#if defined(_WIN32)
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace bustache { namespace
+{
+    struct load_task
+    {
+        std::filesystem::path file;
+        std::string name;
+        std::optional<format> fmt;
+        std::optional<load_error> error;
+    };
+
+    bool read_file(std::filesystem::path const& file, std::string& out)
+    {
+        std::error_code ec;
+        auto const n = std::filesystem::file_size(file, ec);
+        if (ec)
+            return false;
+        std::ifstream in(file, std::ios::binary);
+        out.resize(n);
+        return in && in.read(out.data(), n);
+    }
+
+    // A read-only view of a whole file, which stays valid after the file is
+    // closed.
+    struct mapping
+    {
+        void* data = nullptr;
+        std::size_t size = 0;
+
+        mapping() = default;
+
+        mapping(mapping const&) = delete;
+
+        mapping& operator=(mapping const&) = delete;
+
+        ~mapping()
+        {
+            if (!data)
+                return;
+#if defined(_WIN32)
+            ::UnmapViewOfFile(data);
+#else
+            ::munmap(data, size);
+#endif
+        }
+
+        std::string_view view() const noexcept
+        {
+            return {static_cast<char const*>(data), size};
+        }
+    };
+
+#if defined(_WIN32)
+    std::error_code last_error() noexcept
+    {
+        return {int(::GetLastError()), std::system_category()};
+    }
+
+    // An empty file can't be mapped, and needs none.
+    std::error_code map(std::filesystem::path const& file, mapping& out)
+    {
+        auto const handle = ::CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            return last_error();
+        std::error_code ec;
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(handle, &size))
+            ec = last_error();
+        else if (std::uint64_t(size.QuadPart) > SIZE_MAX)
+            ec = std::make_error_code(std::errc::file_too_large);
+        else if (size.QuadPart)
+        {
+            // The view holds the mapping, which holds the file.
+            if (auto const section = ::CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr))
+            {
+                out.data = ::MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+                if (out.data)
+                    out.size = std::size_t(size.QuadPart);
+                else
+                    ec = last_error();
+                ::CloseHandle(section);
+            }
+            else
+                ec = last_error();
+        }
+        ::CloseHandle(handle);
+        return ec;
+    }
+#else
+    std::error_code last_error() noexcept
+    {
+        return {errno, std::generic_category()};
+    }
+
+    // An empty file can't be mapped, and needs none.
+    std::error_code map(std::filesystem::path const& file, mapping& out)
+    {
+        auto const fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return last_error();
+        std::error_code ec;
+        struct ::stat st;
+        if (::fstat(fd, &st) == -1)
+            ec = last_error();
+        else if (!S_ISREG(st.st_mode))
+            ec = std::make_error_code(std::errc::not_supported);
+        else if (st.st_size)
+        {
+            auto const data = ::mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+                ec = last_error();
+            else
+            {
+                out.data = data;
+                out.size = std::size_t(st.st_size);
+            }
+        }
+        ::close(fd);
+        return ec;
+    }
+#endif
+
+    void load(load_task& task, bool mapped)
+    {
+        if (mapped)
+        {
+            try
+            {
+                task.fmt.emplace(map_file(task.file));
+            }
+            catch (std::filesystem::filesystem_error const&)
+            {
+                task.error = load_error{task.file, -1, "cannot read file"};
+            }
+            catch (format_error const& e)
+            {
+                task.error = load_error{task.file, e.position(), e.what()};
+            }
+            return;
+        }
+        std::string text;
+        if (!read_file(task.file, text))
+        {
+            task.error = load_error{task.file, -1, "cannot read file"};
+            return;
+        }
+        try
+        {
+            task.fmt.emplace(text, true);
+        }
+        catch (format_error const& e)
+        {
+            task.error = load_error{task.file, e.position(), e.what()};
+        }
+    }
+
+    // Parse the files on a pool of threads, which take the next task until
+    // none is left, the calling thread included.
+    load_result run(std::vector<load_task>& tasks, load_options const& options)
+    {
+        auto threads = options.threads;
+        if (!threads)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        threads = unsigned(std::min<std::size_t>(threads, tasks.size()));
+        std::atomic<std::size_t> next{0};
+        std::exception_ptr failure;
+        std::mutex mutex;
+        auto const work = [&]
+        {
+            try
+            {
+                for (std::size_t k; (k = next.fetch_add(1, std::memory_order_relaxed)) < tasks.size();)
+                    load(tasks[k], options.map);
+            }
+            catch (...)
+            {
+                std::lock_guard lock(mutex);
+                if (!failure)
+                    failure = std::current_exception();
+                next = tasks.size();
+            }
+        };
+        std::vector<std::thread> pool;
+        pool.reserve(threads);
+        for (unsigned k = 1; k < threads; ++k)
+        {
+            try
+            {
+                pool.emplace_back(work);
+            }
+            catch (std::system_error const&)
+            {
+                break; // Go on with the threads we have.
+            }
+        }
+        work();
+        for (auto& thread : pool)
+            thread.join();
+        if (failure)
+            std::rethrow_exception(failure);
+
+        load_result ret;
+        ret.partials.reserve(tasks.size());
+        for (auto& task : tasks)
+        {
+            if (task.error)
+                ret.errors.push_back(std::move(*task.error));
+            else
+                ret.partials.try_emplace(std::move(task.name), std::move(*task.fmt));
+        }
+        return ret;
+    }
+}}
+
+namespace bustache
+{
+    format map_file(std::filesystem::path const& file)
+    {
+        auto held = std::make_shared<mapping>();
+        if (auto const ec = map(file, *held))
+            throw std::filesystem::filesystem_error("cannot map file", file, ec);
+        auto const source = held->view();
+        return format(source, std::shared_ptr<void const>(std::move(held)));
+    }
+
+    load_result load_partials(std::filesystem::path const& dir, load_options const& options)
+    {
+        std::vector<load_task> tasks;
+        for (auto const& entry : std::filesystem::recursive_directory_iterator(dir))
+        {
+            auto const& file = entry.path();
+            if (entry.is_regular_file() && file.extension() == options.extension)
+                tasks.push_back({file, file.lexically_relative(dir).replace_extension().generic_string(), {}, {}});
+        }
+        // The directory order is unspecified.
+        std::sort(tasks.begin(), tasks.end(), [](load_task const& a, load_task const& b)
+        {
+            return a.name < b.name;
+        });
+        return run(tasks, options);
+    }
+
+    load_result load_partials(std::span<std::filesystem::path const> files, load_options const& options)
+    {
+        std::vector<load_task> tasks;
+        tasks.reserve(files.size());
+        for (auto const& file : files)
+            tasks.push_back({file, std::filesystem::path(file).replace_extension().generic_string(), {}, {}});
+        return run(tasks, options);
+    }
+}
@@ -0,0 +1,124 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <bustache/optimize.hpp>
+#include <deque>
+#include <string>
+
+namespace bustache { namespace
+{
+    struct optimizer
+    {
+        ast::context const& src;
+        optimize_options const& options;
+        ast::context& ctx;
+        // The merged texts, which don't move as more are added.
+        std::deque<std::string> merged{};
+
+        bool droppable(ast::type kind) const
+        {
+            switch (kind)
+            {
+            case ast::type::inversion: // Not called on a lambda.
+                return true;
+            case ast::type::section:
+            case ast::type::filter:
+            case ast::type::loop:
+                return options.drop_empty_sections;
+            default: // An inheritance block may be overridden.
+                return false;
+            }
+        }
+
+        void operator()(ast::content_list const& contents, ast::content_list& out)
+        {
+            // The run of texts not yet added, `text` is the only one or
+            // `buf` holds them all.
+            ast::text text;
+            std::string buf;
+            unsigned run = 0;
+            auto const flush = [&]
+            {
+                if (run > 1)
+                    text = merged.emplace_back(std::move(buf));
+                if (run)
+                    out.push_back(ctx.add(text));
+                buf.clear();
+                run = 0;
+            };
+            for (auto const content : contents)
+            {
+                switch (content.kind)
+                {
+                case ast::type::text:
+                {
+                    auto const& t = src.texts[content.index];
+                    if (run++ == 0)
+                        text = t;
+                    else
+                    {
+                        if (run == 2)
+                            buf.assign(text);
+                        buf += t;
+                    }
+                    continue;
+                }
+                case ast::type::var_escaped:
+                case ast::type::var_raw:
+                {
+                    auto const& var = src.variables[content.index];
+                    flush();
+                    out.push_back(ctx.add(content.kind, ast::variable{var.key, var.split, {}}));
+                    continue;
+                }
+                case ast::type::section:
+                case ast::type::inversion:
+                case ast::type::filter:
+                case ast::type::loop:
+                case ast::type::inheritance:
+                {
+                    auto const& b = src.blocks[content.index];
+                    ast::block block{b.key, {}, {}};
+                    (*this)(b.contents, block.contents);
+                    if (block.contents.empty() && droppable(content.kind))
+                        continue;
+                    block.text_only = block.contents.size() == 1 && block.contents.front().kind == ast::type::text;
+                    flush();
+                    out.push_back(ctx.add(content.kind, std::move(block)));
+                    continue;
+                }
+                case ast::type::partial:
+                {
+                    auto const& p = src.partials[content.index];
+                    ast::partial partial{p.key, p.indent, {}};
+                    for (auto const& [key, overrides] : p.overriders)
+                        (*this)(overrides, partial.overriders.emplace_back(key, ast::content_list{}).second);
+                    flush();
+                    out.push_back(ctx.add(std::move(partial)));
+                    continue;
+                }
+                case ast::type::null:
+                    flush();
+                    out.push_back(content);
+                    continue;
+                }
+            }
+            flush();
+        }
+    };
+}}
+
+namespace bustache
+{
+    format optimize(ast::document const& doc, optimize_options const& options)
+    {
+        ast::document ret;
+        optimizer opt{doc.ctx, options, ret.ctx};
+        opt(doc.contents, ret.contents);
+        // The merged texts are copied before they're gone.
+        return format(std::move(ret), true);
+    }
+}
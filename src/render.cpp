@@ -6,34 +6,112 @@
 //////////////////////////////////////////////////////////////////////////////*/
 
 #include <bustache/render.hpp>
+#include <bustache/generated.hpp>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <cassert>
+#include "simd.hpp"
 
 namespace bustache::detail
 {
+    // The members that the keys of a document resolve to in the objects of
+    // the types bound, by the index of the segment.
+    struct binding
+    {
+        struct bound_type
+        {
+            std::vector<member const*> members;
+        };
+
+        ast::context const* ctx;
+        std::unordered_map<value_vtable const*, bound_type> types;
+
+        bound_type const* find(value_vtable const* vt) const noexcept
+        {
+            auto const it = types.find(vt);
+            return it == types.end() ? nullptr : &it->second;
+        }
+    };
+
+    // A key to look up, copied into the string that `impl_object::get`
+    // takes only for the models that don't take a `key_descriptor`.
+    struct lookup_key
+    {
+        key_descriptor key;
+        std::string& cache;
+        // The binding of the document that has the key, if any.
+        binding const* bound;
+        unsigned segment;
+        bool cached = false;
+
+        std::string const& str()
+        {
+            if (!cached)
+            {
+                cache.assign(key.str);
+                cached = true;
+            }
+            return cache;
+        }
+    };
+
     struct object_ptr
     {
         void const* data;
-        void(*_get)(void const* self, std::string const& key, value_handler visit);
+        value_vtable const* vt;
 
         static object_ptr from(value_ptr val)
         {
             if (val.vptr->kind == model::object)
-                return {val.data, static_cast<value_vtable const*>(val.vptr)->get};
-            return {nullptr, object_trait::get_default};
+                return from_vtable(val);
+            return {nullptr, &value_vt<void>};
         }
 
         static object_ptr from_nested(value_ptr val)
         {
             if (val.vptr->kind < model::lazy_value)
-                return {val.data, static_cast<value_vtable const*>(val.vptr)->get};
-            return {nullptr, object_trait::get_default};
+                return from_vtable(val);
+            return {nullptr, &value_vt<void>};
+        }
+
+        static object_ptr from_vtable(value_ptr val)
+        {
+            return {val.data, static_cast<value_vtable const*>(val.vptr)};
+        }
+
+        // The keys that the object may have, any if not summarized.
+        static key_filter keys_of(value_ptr val)
+        {
+            if (val.vptr->kind != model::object)
+                return {};
+            auto const keys = static_cast<value_vtable const*>(val.vptr)->keys;
+            return keys ? keys(val.data) : key_filter::any();
         }
 
         constexpr explicit operator bool() const { return !!data; }
 
-        void get(std::string const& key, value_handler visit) const
+        void get(lookup_key& key, value_handler visit) const
         {
-            _get(data, key, visit);
+            if (key.bound)
+            {
+                if (auto const type = key.bound->find(vt))
+                {
+                    auto const m = type->members[key.segment];
+                    return visit(m ? m->get(data) : nullptr);
+                }
+            }
+            if (vt->get_key)
+                vt->get_key(data, key.key, visit);
+            else
+                vt->get(data, key.str(), visit);
         }
     };
 
@@ -41,14 +119,21 @@ namespace bustache::detail
     {
         content_scope const* const parent;
         object_ptr data;
+        key_filter keys;
     };
 
     template<class Visit>
-    void lookup(content_scope const* scope, std::string const& key, Visit const& visit)
+    void lookup(content_scope const* scope, lookup_key& key, Visit const& visit)
     {
         bool found = false;
+        auto const mask = key_filter::mask(key.key);
         do
         {
+            if (!scope->keys.may_contain(mask))
+            {
+                scope = scope->parent;
+                continue;
+            }
             scope->data.get(key, [&](value_ptr val)
             {
                 if (val)
@@ -64,41 +149,33 @@ namespace bustache::detail
         visit(nullptr);
     }
 
-    struct subkey
-    {
-        char const* i;
-        char const* const e;
-
-        constexpr explicit operator bool() const { return i != e; }
-    };
+    using subpath = std::span<key_descriptor const>;
 
     struct nested_resolver
     {
-        using iter = char const*;
-        subkey sub;
+        subpath sub;
         std::string& key_cache;
+        binding const* bound;
+        unsigned segment;
+        // The segment looked up last, for the unresolved handler.
+        key_descriptor& last_key;
         value_handler handle;
         bool done;
 
         void next(object_ptr obj)
         {
-            auto const k0 = ++sub.i;
-            while (sub)
+            last_key = sub.front();
+            lookup_key key{last_key, key_cache, bound, segment++};
+            sub = sub.subspan(1);
+            if (!sub.empty())
             {
-                if (*sub.i == '.')
+                return obj.get(key, [this](value_ptr val)
                 {
-                    key_cache.assign(k0, sub.i);
-                    return obj.get(key_cache, [this](value_ptr val)
-                    {
-                        if (auto const obj = object_ptr::from(val))
-                            next(obj);
-                    });
-                }
-                else
-                    ++sub.i;
+                    if (auto const obj = object_ptr::from(val))
+                        next(obj);
+                });
             }
-            key_cache.assign(k0, sub.i);
-            obj.get(key_cache, [this](value_ptr val)
+            obj.get(key, [this](value_ptr val)
             {
                 if (val)
                 {
@@ -109,16 +186,168 @@ namespace bustache::detail
         }
     };
 
+    // An instruction per node, in depth-first order, with the operands taken
+    // from the node: the text, or the segments of the key. A block is
+    // followed by its body, `skip` is the number of instructions in it.
+    struct instr
+    {
+        ast::type kind;
+        unsigned skip;
+        // The index of the first segment, for the binding.
+        unsigned segment;
+        ast::text text;
+        subpath keys;
+        void const* node;
+    };
+
+    // Either the instructions, or the function generated for the document.
+    struct program
+    {
+        std::vector<instr> code;
+        native_fn native = nullptr;
+    };
+
+    // The threads of a format rendered in parallel, started once and shared
+    // by its renders, which may run at once. A job is run by the calling
+    // thread & as many of the threads as are free until it's done.
+    struct thread_pool
+    {
+        struct job
+        {
+            fn_ref<void()> work;
+            unsigned running = 0;
+            std::condition_variable done{};
+        };
+
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<job*> queue;
+        std::vector<std::thread> threads;
+        bool stop = false;
+
+        explicit thread_pool(unsigned n)
+        {
+            threads.reserve(n);
+            for (unsigned k = 0; k != n; ++k)
+            {
+                try
+                {
+                    threads.emplace_back([this] { loop(); });
+                }
+                catch (std::system_error const&)
+                {
+                    break; // Go on with the threads we have.
+                }
+            }
+        }
+
+        ~thread_pool()
+        {
+            {
+                std::lock_guard lock(mutex);
+                stop = true;
+            }
+            ready.notify_all();
+            for (auto& thread : threads)
+                thread.join();
+        }
+
+        void loop()
+        {
+            std::unique_lock lock(mutex);
+            for (;;)
+            {
+                ready.wait(lock, [this] { return stop || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                auto const j = queue.front();
+                queue.pop_front();
+                ++j->running;
+                lock.unlock();
+                j->work();
+                lock.lock();
+                if (!--j->running)
+                    j->done.notify_all();
+            }
+        }
+
+        // Run `work`, which must not throw, on the calling thread & up to
+        // `n` of the threads. The ones that haven't taken it when the
+        // calling thread is done are not waited for, as `work` runs until
+        // nothing is left.
+        void run(unsigned n, fn_ref<void()> work)
+        {
+            job j{work};
+            n = std::min(n, unsigned(threads.size()));
+            if (n)
+            {
+                {
+                    std::lock_guard lock(mutex);
+                    queue.insert(queue.end(), n, &j);
+                }
+                n == 1 ? ready.notify_one() : ready.notify_all();
+            }
+            work();
+            if (n)
+            {
+                std::unique_lock lock(mutex);
+                std::erase(queue, &j);
+                j.done.wait(lock, [&j] { return !j.running; });
+            }
+        }
+    };
+
+    // The contents of a block, with its instructions or its generated
+    // function if compiled.
+    struct block_body
+    {
+        ast::content_list const& contents;
+        instr const* code;
+        instr const* code_end;
+        native_fn native = nullptr;
+        // The only content if it's a text.
+        ast::text const* text = nullptr;
+        // Makes the view for a lambda instead of the contents, if generated.
+        ast::view(*view)() = nullptr;
+    };
+
+    // The overriders of a partial, from the document or generated.
     struct override_context
     {
         ast::override_map const* map;
         ast::context const* ctx;
+        spec_cache const* specs;
+        std::span<native_override const> natives;
     };
 
     struct override_find_result
     {
         ast::content_list const* found;
         ast::context const* ctx;
+        spec_cache const* specs;
+        native_fn native;
+
+        explicit operator bool() const noexcept
+        {
+            return found || native;
+        }
+    };
+
+    static void escape_attribute(char const* data, std::size_t bytes, output_handler sink);
+    static void escape_unquoted(char const* data, std::size_t bytes, output_handler sink);
+    static void escape_css(char const* data, std::size_t bytes, output_handler sink);
+    static bool is_safe_url(std::string_view url) noexcept;
+
+    // Escapes the text written to the sink as it's output in a context.
+    struct context_sink
+    {
+        output_handler const* sink;
+        void(*escape)(char const* data, std::size_t bytes, output_handler sink);
+
+        void operator()(char const* data, std::size_t bytes) const
+        {
+            escape(data, bytes, *sink);
+        }
     };
 
     struct content_visitor
@@ -129,13 +358,32 @@ namespace bustache::detail
         content_scope const* scope;
         value_ptr cursor;
         std::vector<override_context> chain;
+        spec_cache const* specs = nullptr;
         mutable std::string key_cache;
+        mutable key_descriptor last_key;
+        binding const* bound = nullptr;
+        detail::escaping const* escaped_by = nullptr;
+        detail::parallel const* parallel = nullptr;
+        // Renders a chunk of a list in parallel, which calls only the lazy
+        // values, formats & handlers marked thread-safe.
+        bool worker = false;
 
         output_handler raw_os;
         output_handler escape_os;
         context_handler context;
         unresolved_handler variable_unresolved;
+        // Escape for an attribute value, quoted or not.
+        context_sink attribute_sink;
+        context_sink unquoted_sink;
+        output_handler attribute_os;
+        output_handler unquoted_os;
+        // By `escape_context`, with nothing else escaped for a quoted
+        // attribute as the escapes cover it, or for an unquoted one.
+        context_sink context_sinks[8];
+        context_sink unquoted_sinks[8];
         std::string indent;
+        // The indented text to output at once.
+        std::string indented;
         bool needs_indent;
 
         content_visitor
@@ -147,35 +395,74 @@ namespace bustache::detail
             : ctx(&ctx), scope(&scope), cursor(cursor)
             , raw_os(raw_os), escape_os(escape_os), context(context)
             , variable_unresolved(f)
+            , attribute_sink{&this->raw_os, escape_attribute}
+            , unquoted_sink{&this->raw_os, escape_unquoted}
+            , attribute_os(attribute_sink)
+            , unquoted_os(unquoted_sink)
             , needs_indent()
-        {}
+        {
+            // The ones output whole, see `print_whole`, are not used.
+            void(*const escapes[])(char const*, std::size_t, output_handler) =
+            {
+                escape_html, escape_attribute, escape_unquoted, escape_url,
+                escape_attribute, escape_js, escape_js, escape_css
+            };
+            for (std::size_t k = 0; k != std::size(escapes); ++k)
+            {
+                context_sinks[k] = {&this->raw_os, escapes[k]};
+                unquoted_sinks[k] = {&this->unquoted_os, escapes[k]};
+            }
+            unquoted_sinks[std::size_t(escape_context::unquoted)].sink = &this->raw_os;
+        }
 
         content_visitor(content_visitor const&) = delete;
 
+        // `segment` is the index of the first of `sub` for the binding.
         template<class Visit>
-        void resolve(std::string_view key, Visit visit) const
+        void resolve(subpath sub, binding const* bound, unsigned segment, Visit visit) const
         {
-            auto ki = key.data();
-            auto const ke = ki + key.size();
-            if (ki == ke)
-                return visit(nullptr, subkey{});
-            if (*ki == '.')
-            {
-                subkey sub{ki, ke};
-                if (++ki == ke)
-                    sub.i = ki;
+            if (sub.empty())
+                return visit(nullptr, sub);
+            auto const head = sub.front();
+            sub = sub.subspan(1);
+            if (head.str.empty())
                 return visit(cursor, sub);
-            }
             // Unqualified.
-            auto const k0 = ki;
-            while (ki != ke && *ki != '.') ++ki;
-            key_cache.assign(k0, ki);
-            lookup(scope, key_cache, [&visit, sub = subkey{ki, ke}](value_ptr val)
+            last_key = head;
+            lookup_key key{head, key_cache, bound, segment};
+            lookup(scope, key, [&visit, sub](value_ptr val)
             {
                 visit(val, sub);
             });
         }
 
+        binding const* bound_for_ctx() const noexcept
+        {
+            return bound && bound->ctx == ctx ? bound : nullptr;
+        }
+
+        variable_escaping const* escaping_for(ast::variable const* variable) const noexcept
+        {
+            if (escaped_by && escaped_by->ctx == ctx)
+                return &escaped_by->contexts[variable - ctx->variables.data()];
+            return nullptr;
+        }
+
+        output_handler within_os(escape_context within) const noexcept
+        {
+            switch (within)
+            {
+            case escape_context::attribute:
+                return attribute_os;
+            case escape_context::unquoted:
+                return unquoted_os;
+            default:
+                return raw_os;
+            }
+        }
+
+        void print_whole(variable_escaping e, value_ptr val, char const* spec, spec_slot* slot);
+
         void visit_within(ast::context const& new_ctx, ast::content_list const& contents)
         {
             auto const old_ctx = ctx;
@@ -185,76 +472,153 @@ namespace bustache::detail
             ctx = old_ctx;
         }
 
-        void visit_within(ast::document const& doc)
+        // For the contents of an overrider, within the document it's from.
+        void visit_within(override_find_result const& result)
         {
-            visit_within(doc.ctx, doc.contents);
+            if (result.native)
+                return result.native(*this);
+            auto const old_specs = specs;
+            specs = result.specs;
+            visit_within(*result.ctx, *result.found);
+            specs = old_specs;
         }
 
-        override_find_result find_override(std::string const& key) const;
+        void visit_within(format const& fmt)
+        {
+            auto const& doc = fmt.doc();
+            auto const prog = fmt.program();
+            auto const old_bound = bound;
+            auto const old_escaped_by = escaped_by;
+            auto const old_parallel = parallel;
+            auto const old_specs = specs;
+            bound = fmt.binding();
+            escaped_by = fmt.escaping();
+            parallel = fmt.parallel();
+            specs = fmt.specs();
+            if (!prog)
+                visit_within(doc.ctx, doc.contents);
+            else
+            {
+                auto const old_ctx = ctx;
+                ctx = &doc.ctx;
+                if (prog->native)
+                    prog->native(*this);
+                else
+                    run(prog->code.data(), prog->code.data() + prog->code.size());
+                ctx = old_ctx;
+            }
+            bound = old_bound;
+            escaped_by = old_escaped_by;
+            parallel = old_parallel;
+            specs = old_specs;
+        }
+
+        // Thrown by a worker to leave the rest of the list to the serial
+        // render.
+        struct serial_only {};
+
+        // Before calling a lazy value, format or handler.
+        template<class T>
+        void check_thread_safe(T const* p) const
+        {
+            if (worker && !p->thread_safe)
+                throw serial_only{};
+        }
+
+        bool expand_in_parallel(block_body const& body, value_ptr val);
 
-        void print_value(output_handler os, value_ptr val, char const* sepc);
+        void run(instr const* i, instr const* const end);
 
-        void handle_variable(ast::type tag, value_ptr val, char const* sepc);
+        override_find_result find_override(std::string_view key) const;
 
-        void expand(ast::content_list const& contents)
+        // The spec, if any, is parsed once into the slot, if any.
+        void print_value(output_handler os, value_ptr val, char const* spec, spec_slot* slot);
+
+        void print_variable(ast::type tag, value_ptr val, char const* spec, spec_slot* slot, variable_escaping const* e);
+
+        void handle_variable(ast::type tag, value_ptr val, ast::variable const* variable);
+
+        // Expand the partial, with the indent & the overriders given to it.
+        void expand_partial(format const& fmt, std::string_view partial_indent, override_context const& overriders);
+
+        void expand(block_body const& body)
         {
-            for (auto const content : contents)
+            if (body.native)
+                return body.native(*this);
+            if (body.code)
+                return run(body.code, body.code_end);
+            if (body.text)
+                return (*this)(ast::type::text, body.text);
+            for (auto const content : body.contents)
                 ctx->visit(*this, content);
         }
 
-        void expand_on_object(ast::content_list const& contents, value_ptr val)
+        void expand_on_object(block_body const& body, value_ptr val)
         {
             auto const old_cursor = cursor;
-            object_ptr data{val.data, static_cast<value_vtable const*>(val.vptr)->get};
-            content_scope curr{scope, data};
+            auto const data = object_ptr::from_vtable(val);
+            content_scope curr{scope, data, object_ptr::keys_of(val)};
             cursor = val;
             scope = &curr;
-            expand(contents);
+            expand(body);
             scope = curr.parent;
             cursor = old_cursor;
         }
 
-        void expand_on_value(ast::content_list const& contents, value_ptr val)
+        void expand_on_value(block_body const& body, value_ptr val)
         {
             if (val.vptr->kind == model::object)
-                expand_on_object(contents, val);
+                expand_on_object(body, val);
             else
             {
                 cursor = val;
-                expand(contents);
+                expand(body);
             }
         }
 
-        bool expand_section(ast::type tag, ast::content_list const& contents, value_ptr val);
+        bool expand_section(ast::type tag, block_body const& body, value_ptr val);
+
+        void handle_section(ast::type tag, block_body const& body, value_ptr val);
 
-        void handle_section(ast::type tag, ast::block const& block, value_ptr val);
+        void resolve_and_handle(subpath sub, binding const* bound, unsigned segment, unresolved_handler unresolved, value_handler handle);
 
-        void resolve_and_handle(std::string_view key, unresolved_handler unresolved, value_handler handle);
+        void resolve_and_handle(ast::path path, unresolved_handler unresolved, value_handler handle)
+        {
+            resolve_and_handle(ctx->get_path(path), bound_for_ctx(), path.index, unresolved, handle);
+        }
 
-        void operator()(ast::type, ast::text const* text);
+        void print_indented(ast::text text);
+
+        void operator()(ast::type, ast::text const* text)
+        {
+            if (indent.empty())
+                raw_os(text->data(), text->size());
+            else
+                print_indented(*text);
+        }
 
         void operator()(ast::type tag, ast::variable const* variable)
         {
-            char const* sepc = nullptr;
-            std::string_view key = variable->key;
-            if (auto const split = variable->split)
+            resolve_and_handle(variable->path, variable_unresolved, [=, this](value_ptr val)
             {
-                sepc = key.data() + (split + 1);
-                key = std::string_view(key.data(), split);
-            }
-            resolve_and_handle(key, variable_unresolved, [=, this](value_ptr val)
-            {
-                handle_variable(tag, val, sepc);
+                handle_variable(tag, val, variable);
             });
         }
 
+        ast::text const* text_of(ast::block const* block) const noexcept
+        {
+            return &ctx->texts[block->contents.front().index];
+        }
+
         void operator()(ast::type tag, ast::block const* block)
         {
             if (tag == ast::type::inheritance)
             {
                 auto const result = find_override(block->key);
-                if (result.found)
-                    visit_within(*result.ctx, *result.found);
+                if (result)
+                    visit_within(result);
+                else if (block->text_only)
+                    (*this)(ast::type::text, text_of(block));
                 else
                 {
                     for (auto const content : block->contents)
@@ -263,9 +627,9 @@ namespace bustache::detail
             }
             else
             {
-                resolve_and_handle(block->key, nullptr, [&](value_ptr val)
+                resolve_and_handle(block->path, nullptr, [&](value_ptr val)
                 {
-                    handle_section(tag, *block, val);
+                    handle_section(tag, {block->contents, nullptr, nullptr, nullptr, block->text_only ? text_of(block) : nullptr}, val);
                 });
             }
         }
@@ -275,49 +639,126 @@ namespace bustache::detail
         void operator()(ast::type, void const*) const {} // never called
     };
 
-    override_find_result content_visitor::find_override(std::string const& key) const
+    override_find_result content_visitor::find_override(std::string_view key) const
     {
         for (auto const pm : chain)
         {
+            if (!pm.map)
+            {
+                for (auto const& o : pm.natives)
+                {
+                    if (o.key == key)
+                        return {nullptr, pm.ctx, pm.specs, o.body};
+                }
+                continue;
+            }
             auto const it = pm.map->find(key);
             if (it != pm.map->end())
-                return {&it->second, pm.ctx};
+                return {&it->second, pm.ctx, pm.specs, nullptr};
         }
         return {};
     }
 
-    void content_visitor::print_value(output_handler os, value_ptr val, char const* sepc)
+    void content_visitor::print_value(output_handler os, value_ptr val, char const* spec, spec_slot* slot)
     {
         switch (val.vptr->kind)
         {
         case model::lazy_value:
-            static_cast<lazy_value_vtable const*>(val.vptr)->call(val.data, nullptr, [=, this](value_ptr val)
+        {
+            auto const vt = static_cast<lazy_value_vtable const*>(val.vptr);
+            check_thread_safe(vt);
+            vt->call(val.data, nullptr, [=, this](value_ptr val)
             {
-                print_value(os, val, sepc);
+                print_value(os, val, spec, slot);
             });
             break;
+        }
         case model::lazy_format:
         {
-            auto const fmt = static_cast<lazy_format_vtable const*>(val.vptr)->call(val.data, nullptr);
-            visit_within(fmt.doc());
+            auto const vt = static_cast<lazy_format_vtable const*>(val.vptr);
+            check_thread_safe(vt);
+            auto const fmt = vt->call(val.data, nullptr);
+            visit_within(fmt);
             break;
         }
         default:
-            static_cast<value_vtable const*>(val.vptr)->print(val.data, os, sepc);
+        {
+            auto const vt = static_cast<value_vtable const*>(val.vptr);
+            if (vt->raw)
+                os = raw_os;
+            if (slot)
+                vt->print_parsed(val.data, os, spec, *slot);
+            else
+                vt->print(val.data, os, spec);
+        }
+        }
+    }
+
+    void content_visitor::handle_variable(ast::type tag, value_ptr val, ast::variable const* variable)
+    {
+        char const* spec = nullptr;
+        spec_slot* slot = nullptr;
+        if (auto const split = variable->split)
+        {
+            spec = variable->key.data() + (split + 1);
+            auto const index = std::size_t(variable - ctx->variables.data());
+            if (specs && index < specs->size)
+                slot = &specs->slots[index];
         }
+        print_variable(tag, val, spec, slot, tag == ast::type::var_raw ? nullptr : escaping_for(variable));
     }
 
-    void content_visitor::handle_variable(ast::type tag, value_ptr val, char const* sepc)
+    void content_visitor::print_variable(ast::type tag, value_ptr val, char const* spec, spec_slot* slot, variable_escaping const* e)
     {
         if (needs_indent)
         {
             raw_os(indent.data(), indent.size());
             needs_indent = false;
         }
-        print_value(tag == ast::type::var_raw ? raw_os : escape_os, val, sepc);
+        if (tag == ast::type::var_raw)
+            return print_value(raw_os, val, spec, slot);
+        if (!e)
+            return print_value(escape_os, val, spec, slot);
+        switch (e->context)
+        {
+        case escape_context::url_start:
+        case escape_context::script_value:
+            return print_whole(*e, val, spec, slot);
+        default:
+        {
+            auto& sinks = e->within == escape_context::unquoted ? unquoted_sinks : context_sinks;
+            print_value(sinks[std::size_t(e->context)], val, spec, slot);
+        }
+        }
     }
 
-    bool content_visitor::expand_section(ast::type tag, ast::content_list const& contents, value_ptr val)
+    // The whole output is needed to check the scheme of a URL, or to quote
+    // a script value that is not in a string literal.
+    void content_visitor::print_whole(variable_escaping e, value_ptr val, char const* spec, spec_slot* slot)
+    {
+        if (val.vptr->kind < model::lazy_value && static_cast<value_vtable const*>(val.vptr)->raw)
+            return print_value(raw_os, val, spec, slot);
+        std::string value;
+        print_value([&value](char const* data, std::size_t bytes)
+        {
+            value.append(data, bytes);
+        }, val, spec, slot);
+        auto const os = within_os(e.within);
+        if (e.context == escape_context::url_start)
+        {
+            if (!is_safe_url(value))
+                value = "about:invalid";
+            os(value.data(), value.size());
+        }
+        else
+        {
+            os("\"", 1);
+            escape_js(value.data(), value.size(), os);
+            os("\"", 1);
+        }
+    }
+
+    bool content_visitor::expand_section(ast::type tag, block_body const& body, value_ptr val)
     {
         bool inverted = false;
         auto kind = val.vptr->kind;
@@ -347,19 +788,19 @@ namespace bustache::detail
         case model::atom:
             return static_cast<value_vtable const*>(val.vptr)->test(val.data) ^ inverted;
         case model::object:
-            expand_on_object(contents, val);
+            expand_on_object(body, val);
             return false;
         case model::list:
         {
             auto const vt = static_cast<value_vtable const*>(val.vptr);
             auto const old_cursor = cursor;
             if (!vt->iterate)
-                expand_on_value(contents, val);
-            else
+                expand_on_value(body, val);
+            else if (!expand_in_parallel(body, val))
             {
                 vt->iterate(val.data, [&](value_ptr val)
                 {
-                    expand_on_value(contents, val);
+                    expand_on_value(body, val);
                 });
             }
             cursor = old_cursor;
@@ -368,10 +809,12 @@ namespace bustache::detail
         case model::lazy_value:
         {
             bool ret = false;
-            ast::view const view{*ctx, contents};
-            static_cast<lazy_value_vtable const*>(val.vptr)->call(val.data, &view, [&](value_ptr val)
+            ast::view const view = body.view ? body.view() : ast::view{*ctx, body.contents};
+            auto const vt = static_cast<lazy_value_vtable const*>(val.vptr);
+            check_thread_safe(vt);
+            vt->call(val.data, &view, [&](value_ptr val)
             {
-                ret = expand_section(tag, contents, val);
+                ret = expand_section(tag, body, val);
             });
             return ret;
         }
@@ -379,98 +822,691 @@ namespace bustache::detail
         {
             if (tag == ast::type::filter)
                 return true;
-            ast::view const view{*ctx, contents};
-            auto const fmt = static_cast<lazy_format_vtable const*>(val.vptr)->call(val.data, &view);
-            visit_within(fmt.doc());
+            ast::view const view = body.view ? body.view() : ast::view{*ctx, body.contents};
+            auto const vt = static_cast<lazy_format_vtable const*>(val.vptr);
+            check_thread_safe(vt);
+            auto const fmt = vt->call(val.data, &view);
+            visit_within(fmt);
             return false;
         }
         }
         std::abort(); // Unreachable.
     }
 
-    void content_visitor::handle_section(ast::type tag, ast::block const& block, value_ptr val)
+    // Render the items in chunks on a pool of threads, the calling thread
+    // included, each worker with its own visitor that writes to the buffer
+    // of its chunk. A worker that would call a lazy value, format or handler
+    // that is not thread-safe stops before the item, and the items from there are
+    // rendered serially. Returns false if the list is to be rendered
+    // serially as a whole.
+    bool content_visitor::expand_in_parallel(block_body const& body, value_ptr val)
     {
-        if (expand_section(tag, block.contents, val))
+        auto const vt = static_cast<value_vtable const*>(val.vptr);
+        // The indent of a partial depends on the output before each chunk.
+        if (!parallel || worker || !vt->size || !indent.empty())
+            return false;
+        auto const n = vt->size(val.data);
+        auto const& options = parallel->options;
+        if (n < std::max<std::size_t>(options.threshold, 2))
+            return false;
+        auto threads = unsigned(parallel->pool->threads.size() + 1);
+        auto chunk_size = options.chunk_size;
+        if (!chunk_size)
+            chunk_size = std::max<std::size_t>(n / (threads * 4), 1);
+        struct chunk
         {
-            for (auto const content : block.contents)
-                ctx->visit(*this, content);
+            std::string out;
+            // The ranges of `out` to escape, one per write, which is done as
+            // it's written to the sink as the escape action may not be
+            // thread-safe.
+            std::vector<std::pair<std::size_t, std::size_t>> escaped;
+            std::size_t begin;
+            std::size_t end;
+            // The next item to render.
+            std::size_t done;
+        };
+        std::vector<chunk> chunks((n + chunk_size - 1) / chunk_size);
+        for (std::size_t k = 0; k != chunks.size(); ++k)
+        {
+            auto& c = chunks[k];
+            c.begin = c.done = k * chunk_size;
+            c.end = std::min(c.begin + chunk_size, n);
+        }
+        threads = unsigned(std::min<std::size_t>(threads, chunks.size()));
+        std::atomic<std::size_t> next{0};
+        std::atomic<bool> stop{false};
+        std::exception_ptr failure;
+        std::mutex mutex;
+        auto const work = [&]
+        {
+            chunk* out = nullptr;
+            auto const sink = [&out](char const* data, std::size_t bytes)
+            {
+                out->out.append(data, bytes);
+            };
+            auto const escape_sink = [&out](char const* data, std::size_t bytes)
+            {
+                auto const begin = out->out.size();
+                out->out.append(data, bytes);
+                out->escaped.emplace_back(begin, begin + bytes);
+            };
+            try
+            {
+                content_visitor sub{*ctx, *scope, cursor, sink, escape_sink, context, variable_unresolved};
+                sub.chain = chain;
+                sub.bound = bound;
+                sub.escaped_by = escaped_by;
+                sub.specs = specs;
+                sub.worker = true;
+                for (std::size_t k; !stop && (k = next.fetch_add(1, std::memory_order_relaxed)) < chunks.size();)
+                {
+                    auto& c = chunks[k];
+                    out = &c;
+                    for (; c.done != c.end && !stop; ++c.done)
+                    {
+                        auto const size = c.out.size();
+                        auto const escapes = c.escaped.size();
+                        try
+                        {
+                            sub.expand_on_value(body, vt->at(val.data, c.done));
+                        }
+                        catch (serial_only)
+                        {
+                            c.out.resize(size);
+                            c.escaped.resize(escapes);
+                            stop = true;
+                            return;
+                        }
+                    }
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard lock(mutex);
+                if (!failure)
+                    failure = std::current_exception();
+                stop = true;
+            }
+        };
+        parallel->pool->run(threads - 1, work);
+        if (failure)
+            std::rethrow_exception(failure);
+        for (auto const& c : chunks)
+        {
+            std::size_t pos = 0;
+            for (auto const& [begin, end] : c.escaped)
+            {
+                if (begin != pos)
+                    raw_os(c.out.data() + pos, begin - pos);
+                escape_os(c.out.data() + begin, end - begin);
+                pos = end;
+            }
+            raw_os(c.out.data() + pos, c.out.size() - pos);
+            if (c.done != c.end)
+            {
+                for (auto i = c.done; i != n; ++i)
+                    expand_on_value(body, vt->at(val.data, i));
+                break;
+            }
         }
+        return true;
     }
 
-    void content_visitor::resolve_and_handle(std::string_view key, unresolved_handler unresolved, value_handler handle)
+    void content_visitor::handle_section(ast::type tag, block_body const& body, value_ptr val)
     {
-        resolve(key, [=, this](value_ptr val, subkey sub)
+        if (expand_section(tag, body, val))
+            expand(body);
+    }
+
+    void content_visitor::run(instr const* i, instr const* const end)
+    {
+        while (i != end)
         {
-            if (sub)
+            auto const op = *i++;
+            switch (op.kind)
+            {
+            case ast::type::text:
+                if (indent.empty())
+                    raw_os(op.text.data(), op.text.size());
+                else
+                    print_indented(op.text);
+                break;
+            case ast::type::var_escaped:
+            case ast::type::var_raw:
+            {
+                auto const variable = static_cast<ast::variable const*>(op.node);
+                resolve_and_handle(op.keys, bound_for_ctx(), op.segment, variable_unresolved, [&](value_ptr val)
+                {
+                    handle_variable(op.kind, val, variable);
+                });
+                break;
+            }
+            case ast::type::section:
+            case ast::type::inversion:
+            case ast::type::filter:
+            case ast::type::loop:
+            {
+                auto const block = static_cast<ast::block const*>(op.node);
+                block_body const body{block->contents, i, i + op.skip};
+                resolve_and_handle(op.keys, bound_for_ctx(), op.segment, nullptr, [&](value_ptr val)
+                {
+                    handle_section(op.kind, body, val);
+                });
+                i += op.skip;
+                break;
+            }
+            case ast::type::inheritance:
+            {
+                auto const block = static_cast<ast::block const*>(op.node);
+                auto const result = find_override(block->key);
+                if (result)
+                    visit_within(result);
+                else
+                    run(i, i + op.skip);
+                i += op.skip;
+                break;
+            }
+            case ast::type::partial:
+                (*this)(op.kind, static_cast<ast::partial const*>(op.node));
+                break;
+            case ast::type::null:
+                break;
+            }
+        }
+    }
+
+    void content_visitor::resolve_and_handle(subpath sub, binding const* bound, unsigned segment, unresolved_handler unresolved, value_handler handle)
+    {
+        resolve(sub, bound, segment, [=, this](value_ptr val, subpath sub)
+        {
+            if (!sub.empty())
             {
                 if (auto const obj = object_ptr::from_nested(val))
                 {
-                    nested_resolver nested{sub, key_cache, handle};
+                    nested_resolver nested{sub, key_cache, bound, segment + 1, last_key, handle};
                     if (nested.next(obj), nested.done)
                         return;
                 }
             }
             else if (val)
                 return handle(val);
-            handle(unresolved ? unresolved(key_cache) : nullptr);
+            if (!unresolved)
+                return handle(nullptr);
+            check_thread_safe(&unresolved);
+            key_cache.assign(last_key.str);
+            handle(unresolved(key_cache));
         });
     }
 
-    void content_visitor::operator()(ast::type, ast::text const* text)
+    void content_visitor::print_indented(ast::text text)
     {
-        auto i = text->data();
-        auto const n = text->size();
+        auto const i = text.data();
+        auto const n = text.size();
         assert(n && "empty text shouldn't be in ast");
-        if (indent.empty())
+        auto const e = i + (n - 1); // Don't flush indent on last newline.
+        auto i0 = i;
+        auto p = simd::find_either(i, e, '\n', '\n');
+        if (p == e)
         {
+            if (needs_indent)
+                raw_os(indent.data(), indent.size());
             raw_os(i, n);
-            return;
         }
-        auto const ib = indent.data();
-        auto const in = indent.size();
-        if (needs_indent)
-            raw_os(ib, in);
-        auto i0 = i;
-        auto const e = i + (n - 1); // Don't flush indent on last newline.
-        while (i != e)
+        else
         {
-            if (*i++ == '\n')
+            // Splice the indent after each newline, a block of newlines at a
+            // time, and output the whole.
+            indented.clear();
+            if (needs_indent)
+                indented += indent;
+            while (p != e)
             {
-                raw_os(i0, i - i0);
-                raw_os(ib, in);
-                i0 = i;
+                auto const k = std::min<std::size_t>(e - p, simd::block_size);
+                for (auto m = simd::match_mask(p, k, '\n', '\n'); m; m &= m - 1)
+                {
+                    auto const next = p + (std::countr_zero(m) + 1);
+                    indented.append(i0, next);
+                    indented += indent;
+                    i0 = next;
+                }
+                p += k;
             }
+            indented.append(i0, i + n);
+            raw_os(indented.data(), indented.size());
         }
-        needs_indent = *i++ == '\n';
-        raw_os(i0, i - i0);
+        needs_indent = *e == '\n';
     }
 
     void content_visitor::operator()(ast::type, ast::partial const* partial)
     {
-        if (auto const p = context(partial->key))
+        check_thread_safe(&context);
+        auto const index = std::size_t(partial - ctx->partials.data());
+        std::string const* key = &key_cache;
+        if (specs && index < specs->partials)
+            key = &specs->partial_keys[index];
+        else
+            key_cache.assign(partial->key);
+        if (auto const p = context(*key))
+            expand_partial(*p, partial->indent, {&partial->overriders, ctx, specs, {}});
+    }
+
+    void content_visitor::expand_partial(format const& fmt, std::string_view partial_indent, override_context const& overriders)
+    {
+        // A generated format has no nodes.
+        if (fmt.doc().contents.empty() && !fmt.compiled())
+            return;
+        auto const old_size = indent.size();
+        auto const old_chain = chain.size();
+        indent += partial_indent;
+        needs_indent |= !partial_indent.empty();
+        if (overriders.map ? !overriders.map->empty() : !overriders.natives.empty())
+            chain.push_back(overriders);
+        visit_within(fmt);
+        chain.resize(old_chain);
+        indent.resize(old_size);
+    }
+
+    // The runs & replacements written by an escaper are gathered, so the
+    // sink is called once per buffer full instead of twice per char escaped.
+    struct escape_buffer
+    {
+        output_handler sink;
+        char buf[512];
+        std::size_t size = 0;
+
+        // The buffer is left uninitialized, as only its first `size` chars
+        // are read.
+        explicit escape_buffer(output_handler sink) noexcept : sink(sink) {}
+
+        void append(char const* p, std::size_t n)
         {
-            auto const& doc = p->doc();
-            if (doc.contents.empty())
-                return;
-            auto const old_size = indent.size();
-            auto const old_chain = chain.size();
-            indent += partial->indent;
-            needs_indent |= !partial->indent.empty();
-            if (!partial->overriders.empty())
-                chain.push_back({&partial->overriders, ctx});
-            visit_within(doc);
-            chain.resize(old_chain);
-            indent.resize(old_size);
+            if (n > sizeof(buf) - size)
+            {
+                flush();
+                if (n > sizeof(buf))
+                    return sink(p, n);
+            }
+            std::copy_n(p, n, buf + size);
+            size += n;
+        }
+
+        void flush()
+        {
+            if (size)
+                sink(buf, size);
+            size = 0;
+        }
+    };
+
+    // The replacements of the chars that an escaper escapes, by the char.
+    struct escape_table
+    {
+        char str[256][7];
+        unsigned char size[256];
+
+        // `f(c, str)` writes the replacement of `c` & returns its size.
+        template<class F>
+        static constexpr escape_table make(F f)
+        {
+            escape_table table{};
+            for (unsigned c = 0; c != 256; ++c)
+                table.size[c] = static_cast<unsigned char>(f(static_cast<unsigned char>(c), table.str[c]));
+            return table;
+        }
+    };
+
+    constexpr std::size_t put(char* out, char const* str)
+    {
+        std::size_t n = 0;
+        for (; str[n]; ++n)
+            out[n] = str[n];
+        return n;
+    }
+
+    // `prefix`, the 2 hex digits of `c`, then `suffix`.
+    constexpr std::size_t put_hex(char* out, char const* prefix, unsigned char c, char const* suffix = "")
+    {
+        constexpr char digits[] = "0123456789ABCDEF";
+        auto n = put(out, prefix);
+        out[n++] = digits[c >> 4];
+        out[n++] = digits[c & 15];
+        return n + put(out + n, suffix);
+    }
+
+    using simd::byte_range;
+
+    // Write the text with the chars that `mask` finds in each block replaced
+    // as in the table, and the runs between them in bulk.
+    template<class Mask>
+    static void escape_blocks(char const* data, std::size_t bytes, output_handler sink, escape_table const& table, Mask mask)
+    {
+        escape_buffer out{sink};
+        auto last = data;
+        auto const end = data + bytes;
+        for (auto p = data; p != end;)
+        {
+            auto const n = std::min<std::size_t>(end - p, simd::block_size);
+            for (auto m = mask(p, n); m; m &= m - 1)
+            {
+                auto const it = p + std::countr_zero(m);
+                auto const c = static_cast<unsigned char>(*it);
+                out.append(last, it - last);
+                out.append(table.str[c], table.size[c]);
+                last = it + 1;
+            }
+            p += n;
+        }
+        // Nothing escaped, the text is written as is.
+        if (last == data)
+            return sink(data, bytes);
+        out.append(last, end - last);
+        out.flush();
+    }
+
+    constexpr auto html_table = escape_table::make([](unsigned char c, char* str)
+    {
+        auto const escaped = get_escaped(char(c));
+        return escaped ? put(str, escaped.data) : 0;
+    });
+
+    void escape_html(char const* data, std::size_t bytes, output_handler sink)
+    {
+        escape_blocks(data, bytes, sink, html_table, [](char const* p, std::size_t n)
+        {
+            return simd::match_mask(p, n, '&', '<', '>', '\\', '"');
+        });
+    }
+
+    // As `escape_html`, also the quotes & backticks that can end a value.
+    constexpr auto attribute_table = escape_table::make([](unsigned char c, char* str)
+    {
+        if (c == '\'' || c == '`')
+            return put(str, c == '`' ? "&#96;" : "&#39;");
+        return html_table.size[c] ? put(str, html_table.str[c]) : 0;
+    });
+
+    static void escape_attribute(char const* data, std::size_t bytes, output_handler sink)
+    {
+        escape_blocks(data, bytes, sink, attribute_table, [](char const* p, std::size_t n)
+        {
+            return simd::match_mask(p, n, '&', '<', '>', '\\', '"', '\'', '`');
+        });
+    }
+
+    // As `escape_attribute`, also the spaces & '=' that can end a value or
+    // start another attribute.
+    constexpr auto unquoted_table = escape_table::make([](unsigned char c, char* str)
+    {
+        if (c == '=' || c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f')
+            return put_hex(str, "&#x", c, ";");
+        return attribute_table.size[c] ? put(str, attribute_table.str[c]) : 0;
+    });
+
+    static void escape_unquoted(char const* data, std::size_t bytes, output_handler sink)
+    {
+        escape_blocks(data, bytes, sink, unquoted_table, [](char const* p, std::size_t n)
+        {
+            return simd::match_mask(p, n, '&', '<', '>', '\\', '"', '\'', '`', '=', ' ', '\t', '\n', '\r', '\f');
+        });
+    }
+
+    // Relative, or of a scheme that doesn't run a script. The spaces &
+    // control chars in the scheme are ignored as by the browsers.
+    static bool is_safe_url(std::string_view url) noexcept
+    {
+        char scheme[7];
+        std::size_t n = 0;
+        for (auto const c : url)
+        {
+            if (c == ':')
+            {
+                std::string_view const s(scheme, std::min(n, sizeof(scheme)));
+                return n <= sizeof(scheme) && (s == "http" || s == "https" || s == "mailto");
+            }
+            if (c == '/' || c == '?' || c == '#')
+                return true;
+            if (static_cast<unsigned char>(c) > ' ' && c != 0x7f)
+            {
+                if (n < sizeof(scheme))
+                    scheme[n] = char(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+                ++n;
+            }
+        }
+        return true;
+    }
+
+    constexpr auto json_table = escape_table::make([](unsigned char c, char* str) -> std::size_t
+    {
+        switch (c)
+        {
+        case '"': return put(str, "\\\"");
+        case '\\': return put(str, "\\\\");
+        case '\b': return put(str, "\\b");
+        case '\f': return put(str, "\\f");
+        case '\n': return put(str, "\\n");
+        case '\r': return put(str, "\\r");
+        case '\t': return put(str, "\\t");
         }
+        return c < 0x20 ? put_hex(str, "\\u00", c) : 0;
+    });
+
+    void escape_json(char const* data, std::size_t bytes, output_handler sink)
+    {
+        escape_blocks(data, bytes, sink, json_table, [](char const* p, std::size_t n)
+        {
+            return simd::range_mask(p, n, byte_range{0, 0x1f}, byte_range{'"', '"'}, byte_range{'\\', '\\'});
+        });
+    }
+
+    constexpr auto js_table = escape_table::make([](unsigned char c, char* str) -> std::size_t
+    {
+        switch (c)
+        {
+        case '\\': return put(str, "\\\\");
+        case '\n': return put(str, "\\n");
+        case '\r': return put(str, "\\r");
+        case '\t': return put(str, "\\t");
+        case '"': case '\'': case '`': case '<': case '=': case '>': case '&': case '/': case '$':
+            return put_hex(str, "\\u00", c);
+        }
+        return c < 0x20 || c == 0x7f ? put_hex(str, "\\u00", c) : 0;
+    });
+
+    void escape_js(char const* data, std::size_t bytes, output_handler sink)
+    {
+        escape_blocks(data, bytes, sink, js_table, [](char const* p, std::size_t n)
+        {
+            return simd::range_mask(p, n, byte_range{0, 0x1f}, byte_range{0x7f, 0x7f}, byte_range{'"', '"'},
+                byte_range{'\'', '\''}, byte_range{'`', '`'}, byte_range{'<', '>'}, byte_range{'&', '&'},
+                byte_range{'/', '/'}, byte_range{'\\', '\\'}, byte_range{'$', '$'});
+        });
+    }
+
+    constexpr auto url_table = escape_table::make([](unsigned char c, char* str)
+    {
+        return put_hex(str, "%", c);
+    });
+
+    void escape_url(char const* data, std::size_t bytes, output_handler sink)
+    {
+        escape_blocks(data, bytes, sink, url_table, [](char const* p, std::size_t n)
+        {
+            return ~simd::range_mask(p, n, byte_range{'a', 'z'}, byte_range{'A', 'Z'}, byte_range{'0', '9'},
+                byte_range{'-', '.'}, byte_range{'_', '_'}, byte_range{'~', '~'}) & simd::valid_mask(n);
+        });
+    }
+
+    // The ASCII chars but the alphanumerics as "\XX ", as in a CSS string or
+    // identifier.
+    constexpr auto css_table = escape_table::make([](unsigned char c, char* str)
+    {
+        return put_hex(str, "\\", c, " ");
+    });
+
+    static void escape_css(char const* data, std::size_t bytes, output_handler sink)
+    {
+        escape_blocks(data, bytes, sink, css_table, [](char const* p, std::size_t n)
+        {
+            return ~simd::range_mask(p, n, byte_range{'a', 'z'}, byte_range{'A', 'Z'}, byte_range{'0', '9'},
+                byte_range{0x80, 0xff}) & simd::valid_mask(n);
+        });
     }
 
     void render(output_handler raw_os, output_handler escape_os, format const& fmt, value_ptr data, context_handler context, unresolved_handler f)
     {
-        content_scope scope{nullptr, object_ptr::from(data)};
+        content_scope scope{nullptr, object_ptr::from(data), object_ptr::keys_of(data)};
         auto const& doc = fmt.doc();
         content_visitor visitor{doc.ctx, scope, data, raw_os, escape_os, context, f};
-        for (auto const content : doc.contents)
-            doc.ctx.visit(visitor, content);
+        visitor.visit_within(fmt);
+    }
+
+    // Emit the instructions of the contents, each block followed by its body.
+    static void emit(ast::context const& ctx, ast::content_list const& contents, std::vector<instr>& code)
+    {
+        for (auto const content : contents)
+        {
+            auto const at = code.size();
+            ctx.visit([&]<class Node>(ast::type kind, Node const* node)
+            {
+                auto& op = code.emplace_back(instr{.kind = kind, .skip = 0, .segment = 0, .text = {}, .keys = {}, .node = node});
+                if constexpr (std::is_same_v<Node, ast::text>)
+                    op.text = *node;
+                if constexpr (std::is_same_v<Node, ast::variable> || std::is_same_v<Node, ast::block>)
+                {
+                    op.segment = node->path.index;
+                    op.keys = ctx.get_path(node->path);
+                }
+                if constexpr (std::is_same_v<Node, ast::block>)
+                {
+                    emit(ctx, node->contents, code);
+                    code[at].skip = unsigned(code.size() - at - 1);
+                }
+            }, content);
+        }
+    }
+}
+
+namespace bustache
+{
+    void format::compile()
+    {
+        auto prog = std::make_shared<detail::program>();
+        auto const& doc = this->doc();
+        detail::emit(doc.ctx, doc.contents, prog->code);
+        _program = std::move(prog);
+    }
+
+    void format::compile(detail::native_fn root)
+    {
+        auto prog = std::make_shared<detail::program>();
+        prog->native = root;
+        _program = std::move(prog);
+    }
+
+    void format::render_in_parallel(parallel_options const& options)
+    {
+        auto threads = options.threads;
+        if (!threads)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        // The calling thread renders as well.
+        _parallel = std::make_shared<detail::parallel const>(options, std::make_shared<detail::thread_pool>(threads - 1));
+    }
+
+    format format::bind(detail::value_vtable const* root) const
+    {
+        format ret(*this);
+        auto const& ctx = ret.doc().ctx;
+        auto b = std::make_shared<detail::binding>();
+        b->ctx = &ctx;
+        std::vector<detail::value_vtable const*> pending{root};
+        std::unordered_map<std::string_view, member const*> by_key;
+        while (!pending.empty())
+        {
+            auto const vt = pending.back();
+            pending.pop_back();
+            if (!vt || b->find(vt))
+                continue;
+            if (vt->kind == model::list)
+            {
+                if (vt->item)
+                    pending.push_back(vt->item());
+                continue;
+            }
+            if (vt->kind != model::object || vt->members.empty())
+                continue;
+            by_key.clear();
+            for (auto const& m : vt->members)
+            {
+                by_key.try_emplace(m.key, &m);
+                if (m.model)
+                    pending.push_back(m.model());
+            }
+            auto& type = b->types[vt];
+            type.members.resize(ctx.segments.size());
+            for (std::size_t k = 0; k != ctx.segments.size(); ++k)
+            {
+                auto const it = by_key.find(ctx.segments[k].str);
+                if (it != by_key.end())
+                    type.members[k] = it->second;
+            }
+        }
+        ret._binding = std::move(b);
+        return ret;
+    }
+}
+
+namespace bustache::generated
+{
+    // The body of a generated block, which has no nodes.
+    static ast::content_list const no_contents;
+
+    void text(frame& f, char const* data, std::size_t n)
+    {
+        ast::text const text(data, n);
+        f(ast::type::text, &text);
+    }
+
+    void variable(frame& f, ast::type kind, path keys, char const* spec, detail::spec_slot* slot)
+    {
+        f.resolve_and_handle(keys, nullptr, 0, f.variable_unresolved, [&](value_ptr val)
+        {
+            f.print_variable(kind, val, spec, slot, nullptr);
+        });
+    }
+
+    void lookup(frame& f, path keys, value_handler visit)
+    {
+        f.resolve_and_handle(keys, nullptr, 0, nullptr, visit);
+    }
+
+    void with_object(frame& f, value_ptr val, body_fn body)
+    {
+        f.expand_on_object({no_contents, nullptr, nullptr, body}, val);
+    }
+
+    void for_each(frame& f, value_ptr val, body_fn body)
+    {
+        f.expand_section(ast::type::loop, {no_contents, nullptr, nullptr, body}, val);
+    }
+
+    bool lambda(frame& f, ast::type kind, value_ptr val, body_fn body, view_fn view)
+    {
+        return f.expand_section(kind, {no_contents, nullptr, nullptr, body, nullptr, view}, val);
+    }
+
+    bool inherit(frame& f, std::string_view key)
+    {
+        auto const result = f.find_override(key);
+        if (result)
+            f.visit_within(result);
+        return !!result;
+    }
+
+    void partial(frame& f, std::string const& key, std::string_view indent, std::span<overrider const> overriders)
+    {
+        f.check_thread_safe(&f.context);
+        if (auto const p = f.context(key))
+            f.expand_partial(*p, indent, {nullptr, f.ctx, f.specs, overriders});
     }
 }
 
@@ -484,6 +1520,21 @@ namespace bustache
             os(self.data(), self.size());
     }
 
+    void impl_print<std::string_view>::print(std::string_view self, output_handler os, char const* spec, detail::spec_slot& cache)
+    {
+        detail::print_fmt(self, os, spec, cache);
+    }
+
+    safe_string safe_string::escaped(std::string_view text)
+    {
+        safe_string ret;
+        detail::escape_html(text.data(), text.size(), [&ret](char const* data, std::size_t n)
+        {
+            ret.str.append(data, n);
+        });
+        return ret;
+    }
+
     void impl_print<bool>::print(bool self, output_handler os, char const* spec)
     {
         if (spec)
@@ -491,4 +1542,9 @@ namespace bustache
         else
             self ? os("true", 4) : os("false", 5);
     }
+
+    void impl_print<bool>::print(bool self, output_handler os, char const* spec, detail::spec_slot& cache)
+    {
+        detail::print_fmt(self, os, spec, cache);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,288 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <bustache/serialize.hpp>
+#include <bustache/detail/parser.hpp>
+#include <cstring>
+
+// Layout of an image, where every number is an unsigned LEB128:
+//
+//  image    := magic version texts variables blocks partials contents
+//  texts    := count string*
+//  variables:= count (string split)*
+//  blocks   := count (string contents)*
+//  partials := count (string string count (string contents)*)*
+//  contents := count (kind index)*
+//  string   := size byte*
+//
+// The paths are not stored, a `format` splits the keys again.
+namespace bustache::detail { namespace
+{
+    constexpr char image_magic[4] = {'B', 'S', 'T', 'I'};
+
+    struct image_writer
+    {
+        std::string& out;
+
+        void number(std::size_t n)
+        {
+            for (; n >= 0x80; n >>= 7)
+                out.push_back(char(n | 0x80));
+            out.push_back(char(n));
+        }
+
+        void string(std::string_view s)
+        {
+            number(s.size());
+            out.append(s);
+        }
+
+        void contents(ast::content_list const& list)
+        {
+            number(list.size());
+            for (auto const content : list)
+            {
+                out.push_back(char(content.kind));
+                number(content.index);
+            }
+        }
+
+        void document(ast::document const& doc)
+        {
+            auto const& ctx = doc.ctx;
+            out.append(image_magic, sizeof(image_magic));
+            number(image_version);
+            number(ctx.texts.size());
+            for (auto const& text : ctx.texts)
+                string(text);
+            number(ctx.variables.size());
+            for (auto const& variable : ctx.variables)
+            {
+                string(variable.key);
+                number(variable.split);
+            }
+            number(ctx.blocks.size());
+            for (auto const& block : ctx.blocks)
+            {
+                string(block.key);
+                contents(block.contents);
+            }
+            number(ctx.partials.size());
+            for (auto const& partial : ctx.partials)
+            {
+                string(partial.key);
+                string(partial.indent);
+                number(partial.overriders.size());
+                for (auto const& [key, list] : partial.overriders)
+                {
+                    string(key);
+                    contents(list);
+                }
+            }
+            contents(doc.contents);
+        }
+    };
+
+    struct image_reader
+    {
+        char const* const b;
+        char const* i;
+        char const* const e;
+
+        [[noreturn]] void fail() const
+        {
+            throw format_error(error_badimage, i - b);
+        }
+
+        std::size_t number()
+        {
+            std::size_t n = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7)
+            {
+                if (i == e)
+                    fail();
+                auto const c = static_cast<unsigned char>(*i++);
+                n |= std::size_t(c & 0x7f) << shift;
+                if (!(c & 0x80))
+                    return n;
+            }
+            fail();
+        }
+
+        unsigned index()
+        {
+            auto const n = number();
+            if (n > ~0u)
+                fail();
+            return unsigned(n);
+        }
+
+        // A count of items that take at least one byte each.
+        std::size_t count()
+        {
+            auto const n = number();
+            if (n > std::size_t(e - i))
+                fail();
+            return n;
+        }
+
+        std::string_view string()
+        {
+            auto const n = count();
+            std::string_view ret(i, n);
+            i += n;
+            return ret;
+        }
+
+        ast::content_list contents()
+        {
+            ast::content_list list(count());
+            for (auto& content : list)
+            {
+                if (i == e)
+                    fail();
+                auto const kind = static_cast<unsigned char>(*i++);
+                if (kind > unsigned(ast::type::partial))
+                    fail();
+                content.kind = ast::type(kind);
+                content.index = index();
+            }
+            return list;
+        }
+
+        ast::document document()
+        {
+            if (std::size_t(e - i) < sizeof(image_magic) || std::memcmp(i, image_magic, sizeof(image_magic)))
+                fail();
+            i += sizeof(image_magic);
+            if (number() != image_version)
+                fail();
+            ast::document doc;
+            auto& ctx = doc.ctx;
+            ctx.texts.resize(count());
+            for (auto& text : ctx.texts)
+                text = string();
+            ctx.variables.resize(count());
+            for (auto& variable : ctx.variables)
+            {
+                variable.key = string();
+                variable.split = index();
+                if (variable.split >= variable.key.size() && variable.split)
+                    fail();
+                if (variable.split && !detail::parser::is_valid_spec(variable.key.substr(variable.split + 1)))
+                    fail();
+            }
+            ctx.blocks.resize(count());
+            for (auto& block : ctx.blocks)
+            {
+                block.key = string();
+                block.contents = contents();
+            }
+            ctx.partials.resize(count());
+            for (auto& partial : ctx.partials)
+            {
+                partial.key = string();
+                partial.indent = string();
+                partial.overriders.resize(count());
+                for (auto& [key, list] : partial.overriders)
+                {
+                    key = string();
+                    list = contents();
+                }
+            }
+            doc.contents = contents();
+            if (i != e)
+                fail();
+            return doc;
+        }
+    };
+
+    // Check that every content refers to an existing node, and that no
+    // block or partial contains itself, which would never end rendering.
+    struct image_checker
+    {
+        ast::context const& ctx;
+        std::vector<char> blocks;   // 0: unvisited, 1: visiting, 2: done
+        std::vector<char> partials;
+
+        bool check(ast::content_list const& list)
+        {
+            for (auto const content : list)
+            {
+                if (!check(content))
+                    return false;
+            }
+            return true;
+        }
+
+        bool check(ast::content c)
+        {
+            switch (c.kind)
+            {
+            case ast::type::null:
+                return false;
+            case ast::type::text:
+                return c.index < ctx.texts.size() && !ctx.texts[c.index].empty();
+            case ast::type::var_escaped:
+            case ast::type::var_raw:
+                return c.index < ctx.variables.size();
+            case ast::type::partial:
+                return c.index < ctx.partials.size() && enter(partials[c.index], [&]
+                {
+                    for (auto const& pair : ctx.partials[c.index].overriders)
+                    {
+                        if (!check(pair.second))
+                            return false;
+                    }
+                    return true;
+                });
+            default:
+                return c.index < ctx.blocks.size() && enter(blocks[c.index], [&]
+                {
+                    return check(ctx.blocks[c.index].contents);
+                });
+            }
+        }
+
+        template<class F>
+        static bool enter(char& state, F f)
+        {
+            if (state)
+                return state == 2;
+            state = 1;
+            if (!f())
+                return false;
+            state = 2;
+            return true;
+        }
+    };
+}}
+
+namespace bustache
+{
+    std::string save_image(ast::document const& doc)
+    {
+        std::string out;
+        detail::image_writer{out}.document(doc);
+        return out;
+    }
+
+    ast::document load_image(std::string_view image)
+    {
+        auto const b = image.data();
+        detail::image_reader reader{b, b, b + image.size()};
+        auto doc = reader.document();
+        detail::image_checker checker
+        {
+            doc.ctx,
+            std::vector<char>(doc.ctx.blocks.size()),
+            std::vector<char>(doc.ctx.partials.size())
+        };
+        if (!checker.check(doc.contents))
+            throw format_error(error_badimage, image.size());
+        return doc;
+    }
+}
@@ -0,0 +1,136 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_SRC_SIMD_HPP_INCLUDED
+#define BUSTACHE_SRC_SIMD_HPP_INCLUDED
+
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#if defined(__AVX2__)
+#   define BUSTACHE_SIMD_AVX2
+#   include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define BUSTACHE_SIMD_SSE2
+#   include <emmintrin.h>
+#endif
+
+namespace bustache::detail::simd
+{
+    constexpr std::size_t block_size = 64;
+
+    // Bitmask of the bytes in [p, p + n) that equal any of `cs`, bit k set
+    // for p[k]. Only the first `n` (at most `block_size`) bytes are read.
+    template<class... C>
+    inline std::uint64_t match_mask(char const* p, std::size_t n, C... cs) noexcept
+    {
+        std::uint64_t m = 0;
+        std::size_t k = 0;
+        if (n == block_size)
+        {
+#if defined(BUSTACHE_SIMD_AVX2)
+            for (; k != block_size; k += 32)
+            {
+                auto const x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + k));
+                auto eq = _mm256_setzero_si256();
+                ((eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(cs)))), ...);
+                m |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(eq))) << k;
+            }
+            return m;
+#elif defined(BUSTACHE_SIMD_SSE2)
+            for (; k != block_size; k += 16)
+            {
+                auto const x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + k));
+                auto eq = _mm_setzero_si128();
+                ((eq = _mm_or_si128(eq, _mm_cmpeq_epi8(x, _mm_set1_epi8(cs)))), ...);
+                m |= std::uint64_t(std::uint32_t(_mm_movemask_epi8(eq))) << k;
+            }
+            return m;
+#endif
+        }
+        for (; k != n; ++k)
+        {
+            if (((p[k] == cs) || ...))
+                m |= std::uint64_t(1) << k;
+        }
+        return m;
+    }
+
+    // A range of bytes, [lo, hi].
+    struct byte_range
+    {
+        unsigned char lo;
+        unsigned char hi;
+    };
+
+    // Bitmask of the bytes in [p, p + n) that fall in any of `rs`, as
+    // `match_mask` does.
+    template<class... R>
+    inline std::uint64_t range_mask(char const* p, std::size_t n, R... rs) noexcept
+    {
+        std::uint64_t m = 0;
+        std::size_t k = 0;
+        if (n == block_size)
+        {
+            // x - lo <= hi - lo, unsigned, as min(x - lo, hi - lo) == x - lo.
+#if defined(BUSTACHE_SIMD_AVX2)
+            for (; k != block_size; k += 32)
+            {
+                auto const x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + k));
+                auto in = _mm256_setzero_si256();
+                ((in = _mm256_or_si256(in, [x](byte_range r)
+                {
+                    auto const d = _mm256_sub_epi8(x, _mm256_set1_epi8(char(r.lo)));
+                    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(char(r.hi - r.lo))), d);
+                }(rs))), ...);
+                m |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(in))) << k;
+            }
+            return m;
+#elif defined(BUSTACHE_SIMD_SSE2)
+            for (; k != block_size; k += 16)
+            {
+                auto const x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + k));
+                auto in = _mm_setzero_si128();
+                ((in = _mm_or_si128(in, [x](byte_range r)
+                {
+                    auto const d = _mm_sub_epi8(x, _mm_set1_epi8(char(r.lo)));
+                    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(char(r.hi - r.lo))), d);
+                }(rs))), ...);
+                m |= std::uint64_t(std::uint32_t(_mm_movemask_epi8(in))) << k;
+            }
+            return m;
+#endif
+        }
+        for (; k != n; ++k)
+        {
+            auto const c = static_cast<unsigned char>(p[k]);
+            if ((((unsigned char)(c - rs.lo) <= (unsigned char)(rs.hi - rs.lo)) || ...))
+                m |= std::uint64_t(1) << k;
+        }
+        return m;
+    }
+
+    // The bits of the first `n` (at most `block_size`) bytes of a block.
+    constexpr std::uint64_t valid_mask(std::size_t n) noexcept
+    {
+        return n == block_size ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1;
+    }
+
+    // Return the first position in [i, e) whose byte equals `a` or `b`, or `e`.
+    inline char const* find_either(char const* i, char const* e, char a, char b) noexcept
+    {
+        while (i != e)
+        {
+            auto const n = std::size_t(e - i) < block_size ? std::size_t(e - i) : block_size;
+            if (auto const m = match_mask(i, n, a, b))
+                return i + std::countr_zero(m);
+            i += n;
+        }
+        return e;
+    }
+}
+
+#endif
@@ -45,7 +45,7 @@ R"(<h1>{{header}}</h1>
     </ul>
 </div>)";
 
-static void bustache_usage(benchmark::State& state)
+static void bustache_bench(benchmark::State& state, bool compiled)
 {
     using namespace bustache;
     using namespace test;
@@ -109,6 +109,12 @@ static void bustache_usage(benchmark::State& state)
     };
 
     format fmt(tmp);
+    if (compiled)
+    {
+        fmt.compile();
+        for (auto& [key, partial] : context)
+            partial.compile();
+    }
 
     for (auto _ : state)
     {
@@ -117,6 +123,16 @@ static void bustache_usage(benchmark::State& state)
     }
 }
 
+static void bustache_usage(benchmark::State& state)
+{
+    bustache_bench(state, false);
+}
+
+static void bustache_compiled(benchmark::State& state)
+{
+    bustache_bench(state, true);
+}
+
 static void mstch_usage(benchmark::State& state)
 {
     using namespace mstch;
@@ -257,6 +273,7 @@ static void kainjow_usage(benchmark::State& state)
 }
 
 BENCHMARK(bustache_usage);
+BENCHMARK(bustache_compiled);
 BENCHMARK(mstch_usage);
 BENCHMARK(kainjow_usage);
 
@@ -0,0 +1,591 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+#include <bustache/render/string.hpp>
+#include <bustache/editable_format.hpp>
+#include <bustache/link.hpp>
+#include <bustache/optimize.hpp>
+#include <bustache/serialize.hpp>
+#include <bustache/static_format.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+TEST_CASE("arena")
+{
+    object const data{{"a", object{{"b", "x"}}}, {"n", 42}};
+    context const partials{{"p", "{{$t}}default{{/t}}:{{n:>4}}"_fmt}};
+    format fmt;
+    {
+        std::string const src("{{#a}}[{{b}}]{{/a}}\n  {{<p}}{{$t}}over{{/t}}{{/p}}\n");
+        fmt = format(src, arena);
+    } // The source is gone.
+    std::string const ans("[x]\n  over:  42\n");
+    CHECK(to_string(fmt(data).context(partials)) == ans);
+
+    format copy(fmt);
+    CHECK(to_string(copy(data).context(partials)) == ans);
+
+    format moved(std::move(copy));
+    CHECK(to_string(moved(data).context(partials)) == ans);
+
+    moved = "{{n}}"_fmt;
+    CHECK(to_string(moved(data)) == "42");
+
+    moved = fmt;
+    CHECK(to_string(moved(data).context(partials)) == ans);
+}
+
+TEST_CASE("scan")
+{
+    // The tags & the delimiter changes across the blocks scanned at once.
+    std::string const pad(61, '-');
+    std::string const src = pad + "{{text}}" + pad + "{{=<% %>=}}" + pad + "{<%text%>}\n" + pad + "<%={{ }}=%>{{text}}";
+    std::string const ans = pad + "Hey!" + pad + pad + "{Hey!}\n" + pad + "Hey!";
+    CHECK(to_string(format(src)(object{{"text", "Hey!"}})) == ans);
+}
+
+TEST_CASE("copy")
+{
+    object const data{{"a", object{{"b", "x"}}}, {"n", 42}};
+    std::string const src("{{#a}}[{{b}}]{{/a}}:{{n}}\n");
+    format const fmt(src);
+    format copy(fmt);
+    CHECK(&copy.doc() == &fmt.doc());
+    CHECK(copy.doc().ctx.texts.front().data() == src.data() + 6);
+    CHECK(to_string(copy(data)) == "[x]:42\n");
+
+    copy.compile();
+    CHECK(!fmt.compiled());
+    format const compiled(copy);
+    CHECK(compiled.program() == copy.program());
+
+    // The document of an editable format changes, so it's not shared.
+    editable_format editable(src);
+    format const snapshot(editable.fmt());
+    CHECK(&snapshot.doc() != &editable.fmt().doc());
+    editable.edit(0, editable.source().size(), "{{n}}");
+    CHECK(to_string(snapshot(data)) == "[x]:42\n");
+    CHECK(to_string(editable(data)) == "42");
+
+    format empty;
+    CHECK(format(empty).doc().contents.empty());
+}
+
+TEST_CASE("buffer")
+{
+    object const data{{"a", "<x>"}, {"list", array{1, 2, 3}}};
+    format const fmt("[{{a}}]{{*list}}({{.}}){{/list}}");
+    std::string const ans("[&lt;x&gt;](1)(2)(3)");
+    std::string out;
+    std::vector<std::size_t> calls;
+    auto const sink = [&](char const* data, std::size_t n)
+    {
+        out.append(data, n);
+        calls.push_back(n);
+    };
+    auto const run = [&](std::size_t buffer_size)
+    {
+        out.clear();
+        calls.clear();
+        render(sink, fmt, data, no_context, escape_html, nullptr, buffer_size);
+        CHECK(out == ans);
+    };
+
+    run(default_buffer_size);
+    CHECK(calls.size() == 1);
+
+    // The escaped value is longer than the buffer, so it's written as is.
+    run(8);
+    CHECK(calls == std::vector<std::size_t>{1, 9, 8, 2});
+
+    run(2 * default_buffer_size);
+    CHECK(calls.size() == 1);
+
+    run(0);
+    CHECK(calls.size() > 10);
+
+    for (std::size_t const n : {std::size_t(0), std::size_t(8), 2 * default_buffer_size})
+        CHECK(to_string(fmt(data).escape(escape_html).buffer_size(n)) == ans);
+
+    // The output so far is written before the exception propagates.
+    out.clear();
+    auto const fail = [](std::string const&) -> value_ptr { throw std::runtime_error("unresolved"); };
+    CHECK_THROWS(render(sink, "ok{{none}}"_fmt, data, no_context, no_escape, fail));
+    CHECK(out == "ok");
+}
+
+TEST_CASE("escape")
+{
+    auto const reference = [](std::string const& str)
+    {
+        std::string ret;
+        for (auto const c : str)
+        {
+            if (auto const escaped = detail::get_escaped(c))
+                ret.append(escaped.data, escaped.size);
+            else
+                ret += c;
+        }
+        return ret;
+    };
+    std::string str;
+    for (int n = 0; n != 700; ++n)
+    {
+        // Escaped chars at varying offsets, across the blocks.
+        str += "&<>\\\"ab"[(n * 7 + n / 3) % 7];
+        if (n % 37 > 30 || n < 150 || n > 600)
+        {
+            std::string out;
+            escape_html(detail::string_sink<std::string>{out})(str.data(), str.size());
+            CHECK(out == reference(str));
+        }
+    }
+    std::string const plain(300, 'x');
+    CHECK(to_string("{{a}}"_fmt(object{{"a", plain}}).escape(escape_html)) == plain);
+}
+
+TEST_CASE("escape_actions")
+{
+    auto const escape = [](auto action, std::string const& str)
+    {
+        std::string out;
+        action(detail::string_sink<std::string>{out})(str.data(), str.size());
+        return out;
+    };
+    CHECK(escape(escape_json, "a\"b\\c\n\x01/é") == "a\\\"b\\\\c\\n\\u0001/é");
+    CHECK(escape(escape_js, "</script>'\\\n") == "\\u003C\\u002Fscript\\u003E\\u0027\\\\\\n");
+    CHECK(escape(escape_url, "a b&c=d/é~-._") == "a%20b%26c%3Dd%2F%C3%A9~-._");
+    // A char escaped at varying offsets, across the blocks.
+    std::string const clean(130, 'x');
+    for (std::size_t n = 0; n != clean.size(); ++n)
+    {
+        auto str = clean;
+        str[n] = '"';
+        CHECK(escape(escape_json, str) == clean.substr(0, n) + "\\\"" + clean.substr(n + 1));
+        CHECK(escape(escape_js, str) == clean.substr(0, n) + "\\u0022" + clean.substr(n + 1));
+        CHECK(escape(escape_url, str) == clean.substr(0, n) + "%22" + clean.substr(n + 1));
+    }
+    CHECK(escape(escape_url, clean) == clean);
+}
+
+TEST_CASE("safe_string")
+{
+    auto const safe = safe_string::escaped("<a & b>");
+    CHECK(safe.str == "&lt;a &amp; b&gt;");
+    CHECK(to_string("{{.}}|{{{.}}}"_fmt(safe).escape(escape_html)) == "&lt;a &amp; b&gt;|&lt;a &amp; b&gt;");
+    safe_string const html{"<b>x</b>"};
+    CHECK(to_string("{{.}}"_fmt(html).escape(escape_html)) == "<b>x</b>");
+    CHECK(to_string("{{#.}}y{{/.}}{{^.}}n{{/.}}"_fmt(safe_string{})) == "n");
+}
+
+TEST_CASE("escape_by_context")
+{
+    format fmt("<p title=\"{{s}}\">{{s}}</p><a href=\"{{s}}?q={{s}}\" onclick=\"f('{{s}}')\">\n"
+        "<script>var s = \"{{s}}\";</script><style>a{content:\"{{s}}\"}</style>{{{s}}}<!-- {{s}} -->");
+    object const data{{"s", "a'<b>&c d"}};
+    CHECK(to_string(fmt(data)) == "<p title=\"a'<b>&c d\">a'<b>&c d</p><a href=\"a'<b>&c d?q=a'<b>&c d\" onclick=\"f('a'<b>&c d')\">\n"
+        "<script>var s = \"a'<b>&c d\";</script><style>a{content:\"a'<b>&c d\"}</style>a'<b>&c d<!-- a'<b>&c d -->");
+    fmt.escape_by_context();
+    auto const copy(fmt);
+    CHECK(to_string(copy(data)) ==
+        "<p title=\"a&#39;&lt;b&gt;&amp;c d\">a'&lt;b&gt;&amp;c d</p>"
+        "<a href=\"a&#39;&lt;b&gt;&amp;c d?q=a%27%3Cb%3E%26c%20d\" onclick=\"f('a\\u0027\\u003Cb\\u003E\\u0026c d')\">\n"
+        "<script>var s = \"a\\u0027\\u003Cb\\u003E\\u0026c d\";</script>"
+        "<style>a{content:\"a\\27 \\3C b\\3E \\26 c\\20 d\"}</style>a'<b>&c d<!-- a'&lt;b&gt;&amp;c d -->");
+
+}
+
+TEST_CASE("escape_by_context-unsafe")
+{
+    auto const render = [](char const* src, char const* s)
+    {
+        format fmt(src);
+        fmt.escape_by_context();
+        return to_string(fmt(object{{"s", s}}));
+    };
+    // The scheme at the start of a URL.
+    CHECK(render("<a href=\"{{s}}\">", "javascript:alert(1)") == "<a href=\"about:invalid\">");
+    CHECK(render("<a href=\"{{s}}\">", " JaVa\tScript:alert(1)") == "<a href=\"about:invalid\">");
+    CHECK(render("<a href={{s}}>", "data:text/html,x") == "<a href=about:invalid>");
+    CHECK(render("<a href=\"{{s}}\">", "https://a.b/?x=1&y") == "<a href=\"https://a.b/?x=1&amp;y\">");
+    CHECK(render("<a href=\"{{s}}\">", "mailto:a@b") == "<a href=\"mailto:a@b\">");
+    CHECK(render("<a href=\"{{s}}\">", "/a/b:c") == "<a href=\"/a/b:c\">");
+    // An unquoted value or a tag.
+    CHECK(render("<p title={{s}}>", "x onclick=alert(1)") == "<p title=x&#x20;onclick&#x3D;alert(1)>");
+    CHECK(render("<p {{s}}>", "onclick=\"alert(1)\"") == "<p onclick&#x3D;&quot;alert(1)&quot;>");
+    CHECK(render("<p title=a{{s}}>", "b\n>") == "<p title=ab&#x0A;&gt;>");
+    // A script not in a string literal.
+    CHECK(render("<script>var x = {{s}};</script>", "1;alert(1)") == "<script>var x = \"1;alert(1)\";</script>");
+    CHECK(render("<script>// it's\nvar x = {{s}};</script>", "1") == "<script>// it's\nvar x = \"1\";</script>");
+    CHECK(render("<script>var x = /'/, y = {{s}};</script>", "1") == "<script>var x = /'/, y = \"1\";</script>");
+    CHECK(render("<script>var x = `${a}{{s}}`;</script>", "${b}") == "<script>var x = `${a}\"\\u0024{b}\"`;</script>");
+    CHECK(render("<script>var x = '{{s}}';</script>", "1';alert(1)//") == "<script>var x = '1\\u0027;alert(1)\\u002F\\u002F';</script>");
+    CHECK(render("<p onclick=\"f({{s}})\">", "1)") == "<p onclick=\"f(&quot;1)&quot;)\">");
+    CHECK(render("<p onclick=f({{s}})>", "a b") == "<p onclick=f(&quot;a&#x20;b&quot;)>");
+}
+
+TEST_CASE("parallel")
+{
+    array list(1000);
+    for (int i = 0; i != 1000; ++i)
+        list[i] = object{{"i", i}};
+    // Not thread-safe, the items from there are rendered serially.
+    std::get<object>(list[600])[0].second = lazy_value([](ast::view const*) -> value { return 600; });
+    object const data{{"list", std::move(list)}, {"x", "&"}};
+    format fmt("{{#list}}{{i}}{{x}},{{/list}}");
+    auto const serial = to_string(fmt(data).escape(escape_html));
+    fmt.render_in_parallel({4, 10, 7});
+    CHECK(to_string(fmt(data).escape(escape_html)) == serial);
+    std::string unbuffered;
+    render_string(unbuffered, fmt, data, no_context_t{}, escape_html, nullptr, 0);
+    CHECK(unbuffered == serial);
+
+    std::vector<int> order;
+    std::vector<int> const ns{0, 1, 2};
+    std::vector<std::function<int(ast::view const*)>> unsafe;
+    std::atomic<int> calls{0};
+    std::vector<thread_safe_fn<std::function<int(ast::view const*)>>> safe;
+    for (int i = 0; i != 100; ++i)
+    {
+        unsafe.emplace_back([i, &order](ast::view const*) { order.push_back(i); return i; });
+        safe.push_back(thread_safe(std::function<int(ast::view const*)>([i, &calls](ast::view const*) { ++calls; return i; })));
+    }
+    std::string expected;
+    for (int i = 0; i != 100; ++i)
+        expected += std::to_string(i);
+    format each("{{#.}}{{.}}{{/.}}");
+    each.render_in_parallel({4, 10, 0});
+    CHECK(to_string(each(unsafe)) == expected);
+    CHECK(order.size() == 100);
+    CHECK(std::is_sorted(order.begin(), order.end()));
+    CHECK(to_string(each(safe)) == expected);
+    CHECK(calls == 100);
+}
+
+TEST_CASE("parallel handlers")
+{
+    array list(100);
+    for (int i = 0; i != 100; ++i)
+        list[i] = object{{"i", i}};
+    object const data{{"list", std::move(list)}};
+    format const partial("<{{i}}>");
+    format fmt("{{#list}}{{>p}}{{missing}},{{/list}}");
+    fmt.render_in_parallel({4, 10, 7});
+
+    // Not thread-safe, called only by the serial render.
+    std::vector<std::string> lookups;
+    auto const context = [&](std::string const& key) -> format const*
+    {
+        lookups.push_back(key);
+        return key == "p" ? &partial : nullptr;
+    };
+    std::vector<std::string> unresolved;
+    auto const handler = [&](std::string const& key) -> value_ptr
+    {
+        unresolved.push_back(key);
+        return nullptr;
+    };
+    std::string expected;
+    for (int i = 0; i != 100; ++i)
+        expected += "<" + std::to_string(i) + ">,";
+    std::string out;
+    render_string(out, fmt, data, context, no_escape, handler);
+    CHECK(out == expected);
+    CHECK(lookups == std::vector<std::string>(100, "p"));
+    CHECK(unresolved == std::vector<std::string>(100, "missing"));
+
+    std::atomic<int> calls{0};
+    auto const safe_context = thread_safe([&](std::string const& key) -> format const*
+    {
+        ++calls;
+        return key == "p" ? &partial : nullptr;
+    });
+    auto const safe_handler = thread_safe([&](std::string const&) -> value_ptr
+    {
+        ++calls;
+        return nullptr;
+    });
+    out.clear();
+    render_string(out, fmt, data, safe_context, no_escape, safe_handler);
+    CHECK(out == expected);
+    CHECK(calls == 200);
+
+    // The escape action is applied on the calling thread.
+    std::vector<std::thread::id> escapes;
+    auto const escape = [&escapes](auto const& sink)
+    {
+        return [&escapes, sink](char const* data, std::size_t bytes)
+        {
+            escapes.push_back(std::this_thread::get_id());
+            sink(data, bytes);
+        };
+    };
+    out.clear();
+    render_string(out, fmt, data, safe_context, escape, safe_handler);
+    CHECK(out == expected);
+    CHECK(escapes == std::vector<std::thread::id>(100, std::this_thread::get_id()));
+}
+
+TEST_CASE("image")
+{
+    object const data{{"a", object{{"b", "x"}}}, {"n", 42}, {"list", array{1, 2}}};
+    context const partials{{"p", "{{$t}}default{{/t}}:{{n:>4}}\n|{{$u}}u{{/u}}|"_fmt}};
+    format const fmt("{{#a}}[{{b}}]{{/a}}{{!comment}}{{=<% %>=}}\n"
+        "  <%<p%><%$t%>over<%/t%><%/p%>\n"
+        "<%*list%>(<%.%>)<%/list%><%^none%>!<%/none%>\n");
+    auto const ans(to_string(fmt(data).context(partials)));
+
+    auto const image = save_image(fmt);
+    format const loaded(load_image(image), false);
+    CHECK(to_string(loaded(data).context(partials)) == ans);
+
+    format copied;
+    {
+        auto const image2 = save_image(loaded);
+        CHECK(image2 == image);
+        copied = format(load_image(image2), true);
+    }
+    CHECK(to_string(copied(data).context(partials)) == ans);
+
+    CHECK_THROWS_WITH(load_image(""), "invalid image");
+    CHECK_THROWS_WITH(load_image(image.substr(0, image.size() - 1)), "invalid image");
+    auto bad = image;
+    bad[4] = char(image_version + 1);
+    CHECK_THROWS_WITH(load_image(bad), "invalid image");
+    // The specs are checked as when parsed.
+    auto badspec = save_image("{{n:>4}}"_fmt);
+    badspec.replace(badspec.find("n:>4"), 4, "n:.x");
+    CHECK_THROWS_WITH(load_image(badspec), "invalid image");
+}
+
+TEST_CASE("static")
+{
+    object const data{{"a", object{{"b", "x"}}}, {"n", 42}, {"list", array{1, 2}}};
+    context const partials{{"p", "{{$t}}default{{/t}}:{{n:>4}}\n|{{$u}}u{{/u}}|"_fmt}};
+    auto const& fmt = "{{#a}}[{{a.b}}]{{/a}}{{!comment}}{{=<% %>=}}\n"
+        "  <%<p%><%$t%>over<%/t%><%/p%>\n"
+        "<%*list%>(<%.:>3%>)<%/list%><%^none%>!<%/none%>\n"_sfmt;
+    format const ref("{{#a}}[{{a.b}}]{{/a}}{{!comment}}{{=<% %>=}}\n"
+        "  <%<p%><%$t%>over<%/t%><%/p%>\n"
+        "<%*list%>(<%.:>3%>)<%/list%><%^none%>!<%/none%>\n");
+    auto const ans(to_string(ref(data).context(partials)));
+    CHECK(to_string(fmt(data).context(partials)) == ans);
+    CHECK(save_image(fmt) == save_image(ref));
+    CHECK(&fmt == &"{{#a}}[{{a.b}}]{{/a}}{{!comment}}{{=<% %>=}}\n"
+        "  <%<p%><%$t%>over<%/t%><%/p%>\n"
+        "<%*list%>(<%.:>3%>)<%/list%><%^none%>!<%/none%>\n"_sfmt);
+
+    format const copy(fmt);
+    CHECK(to_string(copy(data).context(partials)) == ans);
+
+    CHECK(to_string(""_sfmt(data)).empty());
+    CHECK(to_string("{{n}}"_sfmt(data)) == "42");
+}
+
+TEST_CASE("edit")
+{
+    object const data{{"a", object{{"b", "x"}}}, {"n", 42}, {"list", array{1, 2}}};
+    context const partials{{"p", "{{$t}}default{{/t}}:{{n:>4}}\n"_fmt}};
+    editable_format fmt("{{#a}}\n[{{b}}]\n{{/a}}\n"
+        "{{*list}}({{.}}){{/list}}\n"
+        "  {{<p}}{{$t}}over{{/t}}{{/p}}\n");
+    auto const check = [&]
+    {
+        format const ref(fmt.source());
+        CHECK(to_string(fmt(data).context(partials)) == to_string(ref(data).context(partials)));
+    };
+    check();
+
+    fmt.edit(10, 1, "b:>3");
+    CHECK(fmt.source().substr(0, 20) == "{{#a}}\n[{{b:>3}}]\n{{");
+    check();
+
+    fmt.edit(fmt.source().find("({{.}})"), 7, "<{{.}}{{n}}>");
+    check();
+
+    fmt.edit(fmt.source().find("{{/a}}"), 6, "{{/a}} {{n}}");
+    check();
+
+    auto const source = std::string(fmt.source());
+    CHECK_THROWS_WITH(fmt.edit(source.find("{{/list}}"), 9, "{{/a}}"), "mismatched end section tag");
+    CHECK(fmt.source() == source);
+    check();
+
+    fmt.edit(0, 0, "{{=<% %>=}}");
+    check();
+
+    fmt.edit(0, fmt.source().size(), "{{n}}");
+    CHECK(to_string(fmt(data)) == "42");
+}
+
+TEST_CASE("optimize")
+{
+    int calls = 0;
+    object const data{{"a", true}, {"n", 42}, {"list", array{1, 2}},
+        {"f", lazy_value([&calls](ast::view const*) -> value { return ++calls; })}};
+    context const partials{{"p", "{{$t}}default{{/t}}:{{n}}\n"_fmt}};
+    format const fmt("a{{!comment}}b\n{{^a}}{{/a}}c\n"
+        "{{#a}}x{{!comment}}y{{^n}}{{/n}}z{{/a}}\n"
+        "{{*list}}{{/list}}{{?f}}{{/f}}{{$t}}{{/t}}\n"
+        "  {{<p}}{{$t}}o{{!comment}}ver{{/t}}{{/p}}\n");
+    auto const ans(to_string(fmt(data).context(partials)));
+    CHECK(calls == 1);
+
+    auto const opt = optimize(fmt);
+    CHECK(to_string(opt(data).context(partials)) == ans);
+    CHECK(calls == 2); // The empty filter still calls the lambda.
+    auto const& ctx = opt.doc().ctx;
+    auto const& contents = opt.doc().contents;
+    REQUIRE(contents.size() == 9);
+    CHECK(*ctx.get_if<ast::type::text>(contents[0]) == "ab\nc\n");
+    auto const section = ctx.get_if<ast::type::section>(contents[1]);
+    REQUIRE(section);
+    REQUIRE(section->contents.size() == 1);
+    CHECK(*ctx.get_if<ast::type::text>(section->contents[0]) == "xyz");
+    CHECK(section->text_only);
+    CHECK(ctx.blocks.size() == 4); // The empty loop, filter & inheritance are kept.
+
+    auto const opt2 = optimize(fmt, {.drop_empty_sections = true});
+    CHECK(to_string(opt2(data).context(partials)) == ans);
+    CHECK(calls == 2);
+    CHECK(opt2.doc().ctx.blocks.size() == 2);
+}
+
+TEST_CASE("compile")
+{
+    object const data
+    {
+        {"a", object{{"b", "x"}}}, {"n", 42}, {"list", array{1, object{{"n", 2}}}},
+        {"wrap", [](ast::view const* view)
+        {
+            ast::document doc;
+            doc.ctx = view->ctx;
+            doc.contents.push_back(doc.ctx.add(ast::text("<")));
+            doc.contents.insert(doc.contents.end(), view->contents.begin(), view->contents.end());
+            doc.contents.push_back(doc.ctx.add(ast::text(">")));
+            return format(std::move(doc), false);
+        }}
+    };
+    context partials{{"p", "{{$t}}default{{/t}}:{{n:>4}}\n|{{$u}}u{{/u}}|\n"_fmt}};
+    format fmt("{{#a}}[{{b}}]{{/a}}{{^none}}!{{/none}}{{?n}}?{{/n}}\n"
+        "  {{<p}}{{$t}}over {{#a}}{{b}}{{/a}}{{/t}}{{/p}}\n"
+        "{{*list}}({{.}}{{n}}){{/list}}{{#wrap}}{{n}}{{/wrap}}{{$t}}t{{/t}}\n");
+    auto const ans(to_string(fmt(data).context(partials)));
+
+    CHECK_FALSE(fmt.compiled());
+    fmt.compile();
+    CHECK(fmt.compiled());
+    CHECK(to_string(fmt(data).context(partials)) == ans);
+
+    partials.at("p").compile();
+    CHECK(to_string(fmt(data).context(partials)) == ans);
+
+    format const copy(fmt);
+    CHECK(copy.compiled());
+    CHECK(to_string(copy(data).context(partials)) == ans);
+}
+
+TEST_CASE("link")
+{
+    object const data
+    {
+        {"a", object{{"b", "x"}}}, {"n", 42}, {"list", array{1, 2}},
+        {"nodes", array{object{{"nodes", array{object{{"nodes", array{}}}}}}}},
+        {"wrap", [](ast::view const* view)
+        {
+            ast::document doc;
+            doc.ctx = view->ctx;
+            doc.contents.push_back(doc.ctx.add(ast::text("<")));
+            doc.contents.insert(doc.contents.end(), view->contents.begin(), view->contents.end());
+            doc.contents.push_back(doc.ctx.add(ast::text(">")));
+            return format(std::move(doc), false);
+        }}
+    };
+    context const partials
+    {
+        {"item", "- {{.}}\n"_fmt},
+        {"list", "list:\n{{#list}}\n  {{>item}}\n{{/list}}\nn: {{n}}\n"_fmt},
+        {"layout", "<{{$title}}none{{/title}}>{{#wrap}}{{n}}{{/wrap}}|{{>body}}|"_fmt},
+        {"body", "{{$title}}body{{/title}}"_fmt},
+        {"mid", "[{{#a}}{{b}}{{/a}}]"_fmt},
+        {"rec", "{{#nodes}}({{>rec}}){{/nodes}}"_fmt},
+        {"page", "{{<layout}}{{$title}}page{{/title}}{{/layout}}"_fmt},
+        {"angle", "<{{$a}}{{/a}}>"_fmt}
+    };
+    auto const check = [&](std::string_view source)
+    {
+        format const fmt(source);
+        auto const linked = link(fmt, partials);
+        CHECK(to_string(linked(data).context(partials)) == to_string(fmt(data).context(partials)));
+        return linked;
+    };
+
+    auto const indented = check("top:\n  {{>list}}\nend {{>mid}}\n");
+    CHECK(indented.doc().ctx.partials.empty());
+    CHECK(to_string(indented(data)) == "top:\n  list:\n    - 1\n    - 2\n  n: 42\nend [x]\n");
+    check("{{>page}}\n  {{>page}}\n");
+    check("  {{<layout}}{{$title}}{{n}}{{/title}}{{/layout}}\n");
+    check("{{#a}}\n  {{>mid}}\n{{/a}}\n  {{>mid}}{{>mid}}\n");
+    CHECK(check("{{>missing}}{{>rec}}").doc().ctx.partials.size() == 2);
+    // Each section ends on another line, linked in linear time.
+    std::string deep;
+    for (int i = 0; i != 40; ++i)
+        deep += "{{#a}}x";
+    for (int i = 0; i != 40; ++i)
+        deep += "\n{{/a}}";
+    check("  {{>mid}}" + deep);
+    // An overrider that refers to itself.
+    CHECK(to_string(check("{{<angle}}{{$a}}x{{#none}}{{$a}}{{/a}}{{/none}}{{/a}}{{/angle}}")(data).context(partials)) == "<x>");
+
+    // The partials kept still see the overriders inlined.
+    format const fmt("{{<layout}}{{$title}}t{{/title}}{{/layout}}");
+    auto const linked = link(fmt, context{{"layout", partials.at("layout")}});
+    CHECK(to_string(linked(data).context(partials)) == to_string(fmt(data).context(partials)));
+}
+
+TEST_CASE("link flattened")
+{
+    object const data{{"title", "Home"}, {"items", array{1, 2}}};
+    context const partials
+    {
+        {"base", "<html>\n  <head>{{$head}}<title>{{$title}}none{{/title}}</title>{{/head}}</head>\n  <body>\n    {{$body}}{{/body}}\n  </body>\n</html>\n"_fmt},
+        {"site", "{{<base}}{{$title}}Site: {{$page}}{{/page}}{{/title}}{{$body}}\n<nav/>\n{{$main}}{{/main}}\n{{/body}}{{/base}}"_fmt},
+        {"list", "{{<site}}{{$page}}{{title}}{{/page}}{{$main}}\n<ul>\n{{#items}}\n  <li>{{.}}</li>\n{{/items}}\n</ul>\n{{/main}}{{/site}}"_fmt}
+    };
+    format const fmt("{{>list}}");
+    auto const ans(to_string(fmt(data).context(partials)));
+
+    auto const linked = link(fmt, partials, {.overridable = false});
+    CHECK(to_string(linked(data)) == ans);
+    auto const& ctx = linked.doc().ctx;
+    CHECK(ctx.partials.empty());
+    CHECK(std::none_of(linked.doc().contents.begin(), linked.doc().contents.end(), [](ast::content c)
+    {
+        return c.kind == ast::type::inheritance;
+    }));
+    CHECK(std::none_of(ctx.blocks.begin(), ctx.blocks.end(), [](ast::block const& b)
+    {
+        return b.key == "head" || b.key == "title" || b.key == "body";
+    }));
+
+    // The overriders of a partial kept are resolved at render time.
+    auto const partly = link(fmt, context{{"list", partials.at("list")}}, {.overridable = false});
+    CHECK(to_string(partly(data).context(partials)) == ans);
+
+    // The outermost overrider wins, as when rendering.
+    format const top("{{<site}}{{$title}}Top{{/title}}{{/site}}");
+    auto const flat = link(top, partials, {.overridable = false});
+    CHECK(to_string(flat(data)) == to_string(top(data).context(partials)));
+    CHECK(to_string(flat(data)).find("<title>Top</title>") != std::string::npos);
+}
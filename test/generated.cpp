@@ -0,0 +1,70 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+#include <bustache/render/string.hpp>
+#include <bustache/link.hpp>
+#include <fstream>
+#include <iterator>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+// Generated by bustachec from generated.mustache.
+format const& generated();
+format const& class_();
+
+TEST_CASE("generated")
+{
+    std::ifstream in(TEMPLATE_FILE, std::ios::binary);
+    std::string const source{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    REQUIRE(!source.empty());
+    format const ref(source);
+
+    object const data
+    {
+        {"header", "<Colors>"},
+        {"items", array
+            {
+                object{{"name", "red"}, {"first", true}},
+                object{{"name", "<green>"}, {"price", 1.5}}
+            }
+        },
+        {"empty", false},
+        {"tags", array{1, "two"}},
+        {"wrap", [](ast::view const* view)
+        {
+            ast::document doc;
+            doc.ctx = view->ctx;
+            doc.contents.push_back(doc.ctx.add(ast::text("(")));
+            doc.contents.insert(doc.contents.end(), view->contents.begin(), view->contents.end());
+            doc.contents.push_back(doc.ctx.add(ast::text(")")));
+            return format(std::move(doc), false);
+        }}
+    };
+    context const partials{{"frame", "<{{$title}}none{{/title}}>\n{{header}}\n"_fmt}};
+
+    auto const& fmt = generated();
+    CHECK(fmt.compiled());
+    CHECK(fmt.doc().contents.empty());
+    auto const ans(to_string(ref(data).context(partials).escape(escape_html)));
+    CHECK(to_string(fmt(data).context(partials).escape(escape_html)) == ans);
+
+    // Used as a partial.
+    context const outer{{"inner", fmt}, {"frame", partials.at("frame")}};
+    auto const inner = to_string("  {{>inner}}"_fmt(data).context(context{{"inner", ref}, {"frame", partials.at("frame")}}).escape(escape_html));
+    CHECK(to_string("  {{>inner}}"_fmt(data).context(outer).escape(escape_html)) == inner);
+    // Which is not inlined, having no nodes.
+    CHECK(to_string(link("  {{>inner}}"_fmt, outer)(data).context(outer).escape(escape_html)) == inner);
+
+    format const copy(fmt);
+    CHECK(copy.compiled());
+    CHECK(to_string(copy(data).context(partials).escape(escape_html)) == ans);
+
+    CHECK(to_string(class_()(data).context(partials).escape(escape_html)) == ans);
+}
@@ -0,0 +1,110 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+#include <bustache/loader.hpp>
+#include <bustache/render/string.hpp>
+#include <fstream>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace fs = std::filesystem;
+
+struct temp_dir
+{
+    fs::path path = fs::temp_directory_path() / "bustache_test_loader";
+
+    temp_dir()
+    {
+        fs::remove_all(path);
+        fs::create_directories(path / "mail");
+    }
+
+    ~temp_dir()
+    {
+        fs::remove_all(path);
+    }
+
+    void write(fs::path const& file, std::string_view text) const
+    {
+        std::ofstream(path / file, std::ios::binary) << text;
+    }
+};
+
+TEST_CASE("directory")
+{
+    temp_dir const dir;
+    dir.write("page.mustache", "{{>mail/header}}|{{>mail/footer}}");
+    dir.write("mail/header.mustache", "Hi {{name}}");
+    dir.write("mail/footer.mustache", "Bye");
+    dir.write("mail/bad.mustache", "ok\n{{#a}}{{/b}}");
+    dir.write("notes.txt", "{{");
+
+    for (unsigned threads : {0u, 1u, 3u})
+    {
+        auto const result = load_partials(dir.path, {threads});
+        REQUIRE(result.partials.size() == 3);
+        CHECK(result.partials.count("mail/header") == 1);
+        REQUIRE(result.errors.size() == 1);
+        auto const& error = result.errors.front();
+        CHECK(error.file == dir.path / "mail/bad.mustache");
+        CHECK(error.position == 12);
+        CHECK(error.message == "mismatched end section tag");
+
+        object const data{{"name", "Ann"}};
+        CHECK(to_string(result.partials.at("page")(data).context(result.partials)) == "Hi Ann|Bye");
+    }
+}
+
+TEST_CASE("files")
+{
+    temp_dir const dir;
+    dir.write("a.mustache", "{{x}}");
+    dir.write("b.html", "[{{>a}}]");
+    fs::path const files[] = {dir.path / "a.mustache", dir.path / "b.html", dir.path / "none.mustache"};
+
+    auto const result = load_partials(files, {2});
+    auto const a = (dir.path / "a").generic_string();
+    auto const b = (dir.path / "b").generic_string();
+    REQUIRE(result.partials.size() == 2);
+    REQUIRE(result.partials.count(a) == 1);
+    REQUIRE(result.errors.size() == 1);
+    CHECK(result.errors.front().file == files[2]);
+    CHECK(result.errors.front().position == -1);
+
+    context const partials{{"a", result.partials.at(a)}};
+    CHECK(to_string(result.partials.at(b)(object{{"x", 1}}).context(partials)) == "[1]");
+}
+
+TEST_CASE("map")
+{
+    temp_dir const dir;
+    dir.write("a.mustache", "<{{x}}>\n");
+    dir.write("b.mustache", "[{{>a}}]");
+    dir.write("empty.mustache", "");
+    dir.write("bad.mustache", "{{#x}}{{/y}}");
+
+    format copy;
+    {
+        auto const fmt = map_file(dir.path / "a.mustache");
+        copy = fmt;
+    } // The mapping is held by the copy.
+    CHECK(to_string(copy(object{{"x", 1}})) == "<1>\n");
+    CHECK(to_string(map_file(dir.path / "empty.mustache")(object{})).empty());
+    CHECK_THROWS_AS(map_file(dir.path / "none.mustache"), fs::filesystem_error);
+    CHECK_THROWS_AS(map_file(dir.path / "bad.mustache"), format_error);
+
+    load_options options;
+    options.map = true;
+    auto const result = load_partials(dir.path, options);
+    REQUIRE(result.partials.size() == 3);
+    REQUIRE(result.errors.size() == 1);
+    CHECK(result.errors.front().position == 9);
+    CHECK(to_string(result.partials.at("b")(object{{"x", 2}}).context(result.partials)) == "[<2>\n]");
+}
@@ -7,6 +7,9 @@
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 #include <bustache/render/string.hpp>
+#include <variant>
+#include <map>
+#include <cctype>
 
 using namespace bustache;
 
@@ -41,6 +44,42 @@ struct bustache::impl_object<S>
     }
 };
 
+// Has its own specs.
+struct Word
+{
+    std::string_view str;
+};
+
+template<>
+struct bustache::impl_model<Word>
+{
+    static constexpr model kind = model::atom;
+};
+
+template<>
+struct bustache::impl_test<Word>
+{
+    static bool test(Word self)
+    {
+        return !self.str.empty();
+    }
+};
+
+template<>
+struct bustache::impl_print<Word>
+{
+    static void print(Word self, output_handler os, char const* spec)
+    {
+        std::string s(self.str);
+        if (spec && std::string_view(spec) == "upper")
+        {
+            for (auto& c : s)
+                c = char(std::toupper(static_cast<unsigned char>(c)));
+        }
+        os(s.data(), s.size());
+    }
+};
+
 struct Sep
 {
     char sep;
@@ -81,6 +120,19 @@ TEST_CASE("fmt-spec")
     CHECK(to_string("{{i:8}}"_fmt(s)) == "      42");
     CHECK(to_string("{{f:.2f}}"_fmt(s)) == "3.14");
     CHECK(to_string("{{s:*>10}}"_fmt(s)) == "*****hello");
+
+    std::vector<std::variant<int, double, std::string>> const v{1, 2.5, 3, "four", 5};
+    CHECK(to_string("{{#.}}[{{.:>4}}]{{/.}}"_fmt(v)) == "[   1][ 2.5][   3][four][   5]");
+
+    // The spec is parsed once for the type first printed, and each time
+    // for the others.
+    std::vector<std::variant<int, std::string>> const w{10, "a", 20};
+    auto const fmt = "{{#.}}[{{.:>3}}]{{/.}}"_fmt;
+    CHECK(to_string(fmt(w)) == "[ 10][  a][ 20]");
+    CHECK(to_string(fmt(w)) == "[ 10][  a][ 20]");
+
+    Word const word{"hello"};
+    CHECK(to_string("{{.:upper}} {{.}}"_fmt(word)) == "HELLO hello");
 }
 
 TEST_CASE("section-alias")
@@ -94,4 +146,21 @@ TEST_CASE("parse-error")
     CHECK_THROWS_WITH("{{:}}"_fmt, "invalid key");
     CHECK_THROWS_WITH("{{:a}}"_fmt, "invalid key");
     CHECK_THROWS_WITH("{{a:}}"_fmt, "invalid key");
+    CHECK_THROWS_WITH("{{&a:>{}}}"_fmt, "invalid format spec");
+    CHECK_THROWS_WITH("{{a:}x}}"_fmt, "invalid format spec");
+    CHECK_THROWS_WITH("{{x:*^zz}}"_fmt, "invalid format spec");
+    CHECK_THROWS_WITH("{{x:>hex}}"_fmt, "invalid format spec");
+    CHECK_THROWS_WITH("{{x:.}}"_fmt, "invalid format spec");
+    CHECK_THROWS_WITH("{{x:!hex}}"_fmt, "invalid format spec");
+    // A custom spec is checked by the formatter when first printed.
+    CHECK_NOTHROW("{{x:hex}}"_fmt);
+    CHECK_NOTHROW("{{x:upper-case_2}}"_fmt);
+    CHECK_THROWS(to_string("{{x:hex}}"_fmt(std::map<std::string, int>{{"x", 1}})));
+    CHECK_NOTHROW("{{a:%Y-%m-%d}}"_fmt);
+    CHECK_NOTHROW("{{a:\u2192^+#012.3Lf}}"_fmt);
+    // At the spec.
+    CHECK_THROWS_MATCHES(format("ab{{x:*^zz}}"), format_error, Catch::Predicate<format_error>([](format_error const& e)
+    {
+        return e.code() == error_badspec && e.position() == 6;
+    }));
 }
\ No newline at end of file
@@ -7,6 +7,10 @@
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 #include <bustache/render/string.hpp>
+#include <map>
+#include <unordered_map>
+#include <variant>
+#include <vector>
 
 struct Inner
 {
@@ -159,6 +163,102 @@ struct bustache::impl_list<RangeRange>
     }
 };
 
+// An object that summarizes its keys, and counts the lookups.
+struct Summarized
+{
+    std::map<std::string, int> map;
+    bustache::key_filter filter;
+    mutable int lookups = 0;
+
+    Summarized(std::initializer_list<std::pair<std::string const, int>> init) : map(init)
+    {
+        for (auto const& pair : map)
+            filter.add(pair.first);
+    }
+};
+
+template<>
+struct bustache::impl_model<Summarized>
+{
+    static constexpr model kind = model::object;
+};
+
+template<>
+struct bustache::impl_object<Summarized>
+{
+    static void get(Summarized const& self, std::string const& key, value_handler visit)
+    {
+        ++self.lookups;
+        auto const found = self.map.find(key);
+        visit(found == self.map.end() ? nullptr : &found->second);
+    }
+
+    static key_filter keys(Summarized const& self)
+    {
+        return self.filter;
+    }
+};
+
+// Counts the keys hashed from strings.
+struct CountingHash : bustache::key_hash
+{
+    static inline int strings = 0;
+
+    using key_hash::operator();
+
+    std::size_t operator()(std::string_view str) const noexcept
+    {
+        ++strings;
+        return key_hash::operator()(str);
+    }
+};
+
+// Models that list their members, which are bound ahead.
+struct Point
+{
+    int x, y;
+};
+
+struct Shape
+{
+    std::string name;
+    Point origin;
+    std::vector<Point> points;
+};
+
+template<>
+struct bustache::impl_model<Point>
+{
+    static constexpr model kind = model::object;
+};
+
+template<>
+struct bustache::impl_object<Point>
+{
+    static constexpr member members[] =
+    {
+        member::of<&Point::x>("x"),
+        member::of<&Point::y>("y")
+    };
+};
+
+template<>
+struct bustache::impl_model<Shape>
+{
+    static constexpr model kind = model::object;
+};
+
+template<>
+struct bustache::impl_object<Shape>
+{
+    static constexpr member members[] =
+    {
+        member::of<&Shape::name>("name"),
+        member::of<&Shape::origin>("origin"),
+        member::of<&Shape::points>("points")
+    };
+};
+
 using namespace bustache;
 
 TEST_CASE("custom_object")
@@ -209,4 +309,68 @@ TEST_CASE("custom_list")
         "1\n"
         "1,2\n"
         "1,2,3\n");
-}
\ No newline at end of file
+}
+
+TEST_CASE("key_filter")
+{
+    key_filter filter;
+    CHECK(!filter.may_contain("a"));
+    filter.add("a");
+    CHECK(filter.may_contain("a"));
+    CHECK(key_filter::any().may_contain("b"));
+
+    std::map<std::string, Summarized> const root{{"outer", {{"n", 2}}}, {"inner", {{"x", 1}}}};
+    auto const& inner = root.at("inner");
+    auto const& outer = root.at("outer");
+    // The keys are picked so that the filters don't collide.
+    REQUIRE(!inner.filter.may_contain("n"));
+    REQUIRE(!outer.filter.may_contain("x"));
+    CHECK(to_string("{{#outer}}{{#inner}}{{x}}{{n}}{{/inner}}{{/outer}}"_fmt(root)) == "12");
+    // "n" is not looked up in `inner`, nor "x" in `outer`.
+    CHECK(inner.lookups == 1);
+    CHECK(outer.lookups == 1);
+}
+
+TEST_CASE("key_descriptor")
+{
+    key_descriptor const key("ab");
+    CHECK(key == "ab");
+    CHECK(key.hash == key_hash{}(std::string("ab")));
+    CHECK(key_hash{}(key) == key.hash);
+
+    std::unordered_map<std::string, int, CountingHash, std::equal_to<>> const map{{"a", 1}, {"b", 2}};
+    std::map<std::string, int, std::less<>> const ordered{{"c", 3}};
+    std::map<std::string, std::variant<int, decltype(map), decltype(ordered)>> const root{{"m", map}, {"o", ordered}};
+    format const fmt("{{#m}}{{a}}{{b}}{{/m}}{{m.a}}{{o.c}}{{#o}}{{c}}{{/o}}");
+    CountingHash::strings = 0;
+    CHECK(to_string(fmt(root)) == "12133");
+    CHECK(CountingHash::strings == 0);
+}
+
+TEST_CASE("bind")
+{
+    Shape const shape{"tri", {1, 2}, {{3, 4}, {5, 6}}};
+    format const fmt("{{name}}@{{origin.x}},{{origin.y}}:"
+        "{{#points}}({{x}},{{y}},{{name}}{{z}}){{/points}}"
+        "{{#origin}}[{{x}}{{>p}}]{{/origin}}");
+    format const p("<{{y}}{{name}}>");
+    auto const partials = [&p](std::string const& key) { return key == "p" ? &p : nullptr; };
+    auto const ans = to_string(fmt(shape).context(partials));
+    CHECK(ans == "tri@1,2:(3,4,tri)(5,6,tri)[1<2tri>]");
+
+    auto const bound = fmt.bind<Shape>();
+    CHECK(bound.bound());
+    CHECK(!fmt.bound());
+    CHECK(&bound.doc() == &fmt.doc());
+    CHECK(to_string(bound(shape).context(partials)) == ans);
+    CHECK(format(bound).bound());
+
+    // Compiled, the nested keys are bound by their segments as well.
+    format compiled(fmt);
+    compiled.compile();
+    CHECK(to_string(compiled.bind<Shape>()(shape).context(partials)) == ans);
+
+    // The objects of other types are looked up as usual.
+    Outer const outer{{42, "Ah-ha"}};
+    CHECK(to_string("{{#inner}}{{i32}}{{/inner}}"_fmt.bind<Shape>()(outer)) == "42");
+}
@@ -0,0 +1,377 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2021 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+
+// Usage: bustachec <input> <output> [name]
+//
+// Generate a C++ source that defines `bustache::format const& name()`, which
+// renders the template with the code generated for it. The name defaults to
+// the stem of the input. Each content list is a function, where the texts are
+// literals, the keys are looked up from their segments as literals, and a
+// section branches on the value found. The source is embedded only if there's
+// a section that may be given a lambda, which is parsed for its view.
+#include <bustache/format.hpp>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using namespace bustache;
+
+    char const* type_name(ast::type kind)
+    {
+        switch (kind)
+        {
+        case ast::type::var_escaped: return "var_escaped";
+        case ast::type::var_raw: return "var_raw";
+        case ast::type::section: return "section";
+        case ast::type::inversion: return "inversion";
+        case ast::type::filter: return "filter";
+        case ast::type::loop: return "loop";
+        default: return nullptr;
+        }
+    }
+
+    // A string literal, in pieces of a line each. The escapes are in octal,
+    // which end after 3 digits, so a digit after them is still a char.
+    void literal(std::ostream& out, std::string_view str, char const* indent)
+    {
+        out << '"';
+        std::size_t col = 0;
+        for (auto const c : str)
+        {
+            if (col >= 72)
+            {
+                out << "\"\n" << indent << '"';
+                col = 0;
+            }
+            auto const u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+                out << '\\' << c, col += 2;
+            else if (u >= 0x20 && u < 0x7f)
+                out << c, ++col;
+            else
+            {
+                char buf[5] = {'\\', char('0' + (u >> 6)), char('0' + ((u >> 3) & 7)), char('0' + (u & 7))};
+                out << buf, col += 4;
+            }
+            if (c == '\n' && col)
+                col = 72; // Break after newlines for readability.
+        }
+        out << '"';
+    }
+
+    struct generator
+    {
+        ast::context const& ctx;
+        // The data the functions refer to: the paths, the keys of the
+        // partials & the slots of the specs.
+        std::ostringstream data{};
+        // The functions, each after the ones it calls, & the overriders.
+        std::vector<std::string> functions{};
+        std::map<std::string, std::string> paths{};
+        unsigned specs = 0;
+        bool views = false;
+
+        // The array of the segments of the key, shared by the nodes of the
+        // same key.
+        std::string path(ast::path p)
+        {
+            auto const segments = ctx.get_path(p);
+            std::string key;
+            for (auto const& segment : segments)
+                key.append(segment.str) += '.';
+            auto const [it, added] = paths.try_emplace(key, "path" + std::to_string(paths.size()));
+            if (added)
+            {
+                data << "    constexpr key_descriptor " << it->second << "[] = {";
+                for (std::size_t k = 0; k != segments.size(); ++k)
+                {
+                    data << (k ? ", " : "") << "key_descriptor(";
+                    literal(data, segments[k].str, "        ");
+                    data << ')';
+                }
+                data << "};\n";
+            }
+            return it->second;
+        }
+
+        // Generate the function for the contents & return its name. The
+        // nested bodies are generated first, so they're defined before use.
+        std::string body(ast::content_list const& contents, std::string name)
+        {
+            std::ostringstream out;
+            out << "    void " << name << "(frame& f)\n    {\n";
+            // The adjacent texts are output at once.
+            std::string text;
+            auto const flush = [&]
+            {
+                if (text.empty())
+                    return;
+                out << "        text(f, ";
+                literal(out, text, "            ");
+                out << ", " << text.size() << ");\n";
+                text.clear();
+            };
+            for (auto const content : contents)
+            {
+                if (content.kind == ast::type::text)
+                    text += ctx.texts[content.index];
+                if (content.kind == ast::type::text || content.kind == ast::type::null)
+                    continue;
+                flush();
+                switch (content.kind)
+                {
+                case ast::type::null:
+                case ast::type::text:
+                    break;
+                case ast::type::var_escaped:
+                case ast::type::var_raw:
+                {
+                    auto const& var = ctx.variables[content.index];
+                    out << "        variable(f, type::" << type_name(content.kind) << ", " << path(var.path);
+                    if (var.split)
+                    {
+                        out << ", ";
+                        literal(out, var.key.substr(var.split + 1), "            ");
+                        out << ", &slots[" << specs++ << ']';
+                    }
+                    out << ");\n";
+                    break;
+                }
+                case ast::type::section:
+                case ast::type::inversion:
+                case ast::type::filter:
+                case ast::type::loop:
+                    section(out, content.kind, content.index);
+                    break;
+                case ast::type::inheritance:
+                {
+                    auto const fn = block(content.index);
+                    out << "        if (!inherit(f, ";
+                    literal(out, ctx.blocks[content.index].key, "            ");
+                    out << "))\n            " << fn << "(f);\n";
+                    break;
+                }
+                case ast::type::partial:
+                    partial(out, content.index);
+                    break;
+                }
+            }
+            flush();
+            out << "    }\n";
+            functions.push_back(out.str());
+            return name;
+        }
+
+        std::string block(unsigned index)
+        {
+            return body(ctx.blocks[index].contents, "block" + std::to_string(index));
+        }
+
+        // The view of the block for a lambda, from the document parsed from
+        // the source.
+        std::string view(unsigned index)
+        {
+            views = true;
+            auto name = "view" + std::to_string(index);
+            functions.push_back("    bustache::ast::view " + name + "()\n    {\n"
+                "        auto const& ctx = doc().ctx;\n"
+                "        return {ctx, ctx.blocks[" + std::to_string(index) + "].contents};\n    }\n");
+            return name;
+        }
+
+        // Branch on the value looked up, as `content_visitor::expand_section`
+        // does for the kind of the block.
+        void section(std::ostream& out, ast::type kind, unsigned index)
+        {
+            auto const fn = block(index);
+            // An inverted lambda is not called.
+            auto const lambda = kind == ast::type::inversion ? std::string() : view(index);
+            out << "        lookup(f, " << path(ctx.blocks[index].path) << ", [&f](value_ptr v)\n        {\n";
+            switch (kind)
+            {
+            case ast::type::section:
+                out << "            switch (kind_of(v))\n"
+                    << "            {\n"
+                    << "            case model::null:\n"
+                    << "                break;\n"
+                    << "            case model::atom:\n"
+                    << "                if (test(v))\n"
+                    << "                    " << fn << "(f);\n"
+                    << "                break;\n"
+                    << "            case model::object:\n"
+                    << "                with_object(f, v, " << fn << ");\n"
+                    << "                break;\n"
+                    << "            case model::list:\n"
+                    << "                for_each(f, v, " << fn << ");\n"
+                    << "                break;\n"
+                    << "            default:\n"
+                    << "                if (lambda(f, type::section, v, " << fn << ", " << lambda << "))\n"
+                    << "                    " << fn << "(f);\n"
+                    << "            }\n";
+                break;
+            case ast::type::inversion:
+                out << "            if (!is_lazy(v) && !test(v))\n"
+                    << "                " << fn << "(f);\n";
+                break;
+            case ast::type::filter:
+                out << "            if (is_lazy(v) ? lambda(f, type::filter, v, " << fn << ", " << lambda << ") : test(v))\n"
+                    << "                " << fn << "(f);\n";
+                break;
+            default:
+                out << "            if (!is_lazy(v))\n"
+                    << "                for_each(f, v, " << fn << ");\n"
+                    << "            else if (lambda(f, type::loop, v, " << fn << ", " << lambda << "))\n"
+                    << "                " << fn << "(f);\n";
+                break;
+            }
+            out << "        });\n";
+        }
+
+        void partial(std::ostream& out, unsigned index)
+        {
+            auto const& p = ctx.partials[index];
+            auto const key = "key" + std::to_string(index);
+            data << "    std::string const " << key << '(';
+            literal(data, p.key, "        ");
+            data << ", " << p.key.size() << ");\n";
+            std::string overriders;
+            if (!p.overriders.empty())
+            {
+                overriders = "overriders" + std::to_string(index);
+                std::vector<std::string> fns;
+                for (auto const& [name, contents] : p.overriders)
+                    fns.push_back(body(contents, overriders + '_' + std::to_string(fns.size())));
+                std::ostringstream def;
+                def << "    constexpr overrider " << overriders << "[] =\n    {\n";
+                for (std::size_t k = 0; k != fns.size(); ++k)
+                {
+                    def << "        {";
+                    literal(def, p.overriders[k].first, "            ");
+                    def << ", " << fns[k] << "},\n";
+                }
+                def << "    };\n";
+                functions.push_back(def.str());
+            }
+            out << "        partial(f, " << key << ", ";
+            literal(out, p.indent, "            ");
+            if (!overriders.empty())
+                out << ", " << overriders;
+            out << ");\n";
+        }
+    };
+
+    // The names that can't be the one of a function in the global namespace.
+    constexpr std::string_view reserved[] =
+    {
+        "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor",
+        "bool", "break", "bustache", "case", "catch", "char", "char8_t", "char16_t",
+        "char32_t", "class", "co_await", "co_return", "co_yield", "compl", "concept",
+        "const", "const_cast", "consteval", "constexpr", "constinit", "continue",
+        "decltype", "default", "delete", "do", "double", "dynamic_cast", "else",
+        "enum", "explicit", "export", "extern", "false", "float", "for", "friend",
+        "goto", "if", "inline", "int", "long", "main", "mutable", "namespace", "new",
+        "noexcept", "not", "not_eq", "nullptr", "operator", "or", "or_eq", "private",
+        "protected", "public", "register", "reinterpret_cast", "requires", "return",
+        "short", "signed", "sizeof", "static", "static_assert", "static_cast",
+        "struct", "switch", "template", "this", "thread_local", "throw", "true",
+        "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+        "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"
+    };
+
+    // The name with the chars other than alphanumerics as '_', and a '_'
+    // added if it would start with a digit or be reserved.
+    std::string identifier(std::string name)
+    {
+        for (auto& c : name)
+        {
+            if (!std::isalnum(static_cast<unsigned char>(c)))
+                c = '_';
+        }
+        if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+            name.insert(0, 1, '_');
+        else if (std::ranges::find(reserved, name) != std::end(reserved))
+            name += '_';
+        return name;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3 || argc > 4)
+    {
+        std::cerr << "usage: bustachec <input> <output> [name]\n";
+        return 2;
+    }
+    std::filesystem::path const input(argv[1]);
+    auto const name = identifier(argc == 4 ? argv[3] : input.stem().string());
+
+    std::ifstream in(input, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << input.string() << ": cannot read file\n";
+        return 1;
+    }
+    std::string const source{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    std::ostringstream out;
+    try
+    {
+        format const fmt(source);
+        generator gen{fmt.doc().ctx};
+        gen.body(fmt.doc().contents, "root");
+
+        out << "// Generated by bustachec from " << input.filename().string() << ", do not edit.\n"
+            << "#include <bustache/generated.hpp>\n\n"
+            << "namespace\n{\n"
+            << "    using namespace bustache::generated;\n"
+            << "    using bustache::ast::type;\n"
+            << "    using bustache::key_descriptor;\n"
+            << "    using bustache::model;\n"
+            << "    using bustache::value_ptr;\n\n"
+            << gen.data.str();
+        if (gen.specs)
+        {
+            out << "    bustache::detail::spec_slot slots[" << gen.specs << "];\n"
+                << "    bustache::detail::spec_cache const specs(slots, " << gen.specs << ");\n";
+        }
+        if (gen.views)
+        {
+            out << "\n    constexpr char source[] =\n        ";
+            literal(out, source, "        ");
+            out << ";\n\n"
+                << "    // Parsed for the lambdas only.\n"
+                << "    bustache::ast::document const& doc()\n    {\n"
+                << "        static bustache::format const fmt(std::string_view(source, sizeof(source) - 1));\n"
+                << "        return fmt.doc();\n    }\n";
+        }
+        for (auto const& fn : gen.functions)
+            out << '\n' << fn;
+        out << "}\n\n"
+            << "bustache::format const& " << name << "()\n{\n"
+            << "    static bustache::format const fmt = bustache::generated::make_format(root);\n"
+            << "    return fmt;\n}\n";
+    }
+    catch (format_error const& e)
+    {
+        std::cerr << input.string() << ':' << e.position() << ": " << e.what() << '\n';
+        return 1;
+    }
+
+    std::ofstream file(argv[2], std::ios::binary);
+    if (!(file << out.str()))
+    {
+        std::cerr << argv[2] << ": cannot write file\n";
+        return 1;
+    }
+}